@@ -0,0 +1,71 @@
+#!/bin/sh
+# Runs every ROM in the corpus headlessly and compares the results
+# against a stored baseline.
+#
+# USAGE: run_bench.sh <dangerboy-headless> <rom dir> <corpus> <baseline> [-u]
+#
+# With -u, the results replace the baseline instead.
+
+if [ $# -lt 4 ]; then
+   echo "USAGE: $0 <dangerboy-headless> <rom dir> <corpus> <baseline> [-u]"
+   exit 1
+fi
+
+BIN=$1
+ROMS=$2
+CORPUS=$3
+BASELINE=$4
+UPDATE=$5
+RESULTS=$(mktemp)
+
+# Each result is: <rom> <frames> <fps> <mhz> <median ns> <p99 ns>
+grep -v '^ *#' "$CORPUS" | while read -r ROM FRAMES; do
+   [ -z "$ROM" ] && continue
+   if [ ! -f "$ROMS/$ROM" ]; then
+      echo "Skipping $ROM, not found in $ROMS" >&2
+      continue
+   fi
+   "$BIN" "$ROMS/$ROM" --bench "$FRAMES" --json | awk -v rom="$ROM" '
+      function field(name,   s) {
+         s = $0
+         sub(".*\"" name "\": *", "", s)
+         sub("[,}].*", "", s)
+         return s
+      }
+      { print rom, field("frames"), field("fps"), field("mhz"),
+              field("median"), field("p99") }'
+done > "$RESULTS"
+
+if [ "$UPDATE" = "-u" ]; then
+   cp "$RESULTS" "$BASELINE"
+   echo "Baseline written to $BASELINE"
+fi
+
+[ -f "$BASELINE" ] || BASELINE=/dev/null
+awk '
+   FILENAME == ARGV[1] { base[$1] = $3; next }
+   BEGIN {
+      printf "%-36s %10s %10s %8s %10s %10s\n",
+         "ROM", "fps", "baseline", "change", "median us", "p99 us"
+   }
+   {
+      if ($1 in base && base[$1] > 0) {
+         b = sprintf("%10.1f", base[$1])
+         c = sprintf("%+7.1f%%", ($3 / base[$1] - 1) * 100)
+         ratio += log($3 / base[$1])
+         compared++
+      } else {
+         b = sprintf("%10s", "-")
+         c = sprintf("%8s", "-")
+      }
+      printf "%-36s %10.1f %s %s %10.1f %10.1f\n",
+         $1, $3, b, c, $5 / 1000, $6 / 1000
+   }
+   END {
+      if (compared > 0) {
+         printf "\nGeometric mean speedup over %d ROMs: %.3fx\n",
+            compared, exp(ratio / compared)
+      }
+   }' "$BASELINE" "$RESULTS"
+
+rm -f "$RESULTS"
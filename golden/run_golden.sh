@@ -0,0 +1,39 @@
+#!/bin/sh
+# Checks the frames listed in the manifest against the golden hashes
+# in this directory, with both the inline and the threaded renderer.
+#
+# USAGE: run_golden.sh <dangerboy-headless> <rom dir> <manifest> [-u]
+#
+# With -u, the current frames become the new golden frames.
+
+if [ $# -lt 3 ]; then
+   echo "USAGE: $0 <dangerboy-headless> <rom dir> <manifest> [-u]"
+   exit 1
+fi
+
+BIN=$1
+ROMS=$2
+MANIFEST=$3
+DIR=$(dirname "$MANIFEST")
+STATUS=0
+
+grep -v '^ *#' "$MANIFEST" | {
+   while read -r ROM FRAMES; do
+      [ -z "$ROM" ] && continue
+      if [ ! -f "$ROMS/$ROM" ]; then
+         echo "Skipping $ROM, not found in $ROMS" >&2
+         continue
+      fi
+      if [ "$4" = "-u" ]; then
+         "$BIN" "$ROMS/$ROM" --golden "$DIR" --hash-frames "$FRAMES" \
+            --update || STATUS=1
+         continue
+      fi
+      "$BIN" "$ROMS/$ROM" --golden "$DIR" --hash-frames "$FRAMES" \
+         || STATUS=1
+      OUT=$("$BIN" "$ROMS/$ROM" --golden "$DIR" --hash-frames "$FRAMES" \
+         --threaded) || STATUS=1
+      echo "$OUT" | sed 's/^/threaded  /'
+   done
+   exit $STATUS
+}
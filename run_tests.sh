@@ -1,2 +1,32 @@
 #!/bin/sh
-ls -a tests/passed/*.gb | xargs -i bin/dangerboy {} -v
+# Runs test ROMs in parallel with one headless process per core.
+# Mooneye and Blargg ROMs report their own result, so nothing needs
+# watching.
+#
+# USAGE: run_tests.sh [ROM or directory ...]
+#
+# Defaults to tests/passed. Set BIN to use a different build and
+# FRAMES to change how long a ROM gets before it times out.
+
+BIN=${BIN:-bin/dangerboy-headless}
+FRAMES=${FRAMES:-1200}
+JOBS=$(nproc 2>/dev/null || echo 4)
+
+if [ $# -eq 0 ]; then
+   set -- tests/passed
+fi
+
+START=$(date +%s%N)
+RESULTS=$(find "$@" -name '*.gb' | sort \
+   | xargs -P "$JOBS" -I{} "$BIN" {} --test --frames "$FRAMES" | sort -k2)
+END=$(date +%s%N)
+
+echo "$RESULTS"
+PASSED=$(echo "$RESULTS" | grep -c '^PASS')
+FAILED=$(echo "$RESULTS" | grep -c '^FAIL')
+TIMEOUT=$(echo "$RESULTS" | grep -c '^TIMEOUT')
+echo
+echo "$PASSED passed, $FAILED failed, $TIMEOUT timed out" \
+   "in $(( (END - START) / 1000000 )) ms on $JOBS jobs"
+
+[ "$FAILED" -eq 0 ] && [ "$TIMEOUT" -eq 0 ]
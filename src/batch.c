@@ -0,0 +1,387 @@
+// sysconf needs POSIX, which -std=c11 hides
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "cpu.h"
+#include "gb.h"
+#include "golden.h"
+#include "input.h"
+#include "lcd.h"
+#include "memory.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define PATH_LEN 1024
+#define MAX_WORKERS 256
+#define BUTTON_COUNT 8
+
+typedef struct batch_job_ {
+   char* rom;
+   int frames;
+   char* script; // NULL for no input
+} batch_job;
+
+typedef struct script_event_ {
+   int frame;
+   input_kind kind;
+   byte mask;
+   bool pressed;
+} script_event;
+
+// Each worker starts with a contiguous run of jobs, so jobs on the
+// same ROM tend to stay on one worker. The owner takes jobs from the
+// bottom end and idle workers steal from the top. No jobs are added
+// once running, so a range is all a deque needs to hold.
+typedef struct job_deque_ {
+   int top;
+   int bottom;
+   pthread_mutex_t lock;
+} job_deque;
+
+// What a worker keeps between jobs
+typedef struct worker_cache_ {
+   char rom[PATH_LEN];
+   byte* data;
+   size_t size;
+   bool booted; // The worker's Game Boy is on, running this ROM
+} worker_cache;
+
+// ------------------
+// Internal variables
+// ------------------
+
+const struct {
+   const char* name;
+   input_kind kind;
+   byte mask;
+} script_buttons[BUTTON_COUNT] = {
+   {"a", INPUT_BUTTON, A},
+   {"b", INPUT_BUTTON, B},
+   {"select", INPUT_BUTTON, SELECT},
+   {"start", INPUT_BUTTON, START},
+   {"right", INPUT_DPAD, RIGHT},
+   {"left", INPUT_DPAD, LEFT},
+   {"up", INPUT_DPAD, UP},
+   {"down", INPUT_DPAD, DOWN},
+};
+
+batch_job* batch_jobs;
+int batch_count;
+job_deque deques[MAX_WORKERS];
+int worker_count;
+FILE* result_out;
+const char* ram_dump_dir;
+pthread_mutex_t result_lock;
+int failed_jobs;
+
+// ------------------
+// Internal functions
+// ------------------
+
+int read_jobs(const char* list);
+int next_job(int self);
+byte* read_file(const char* path, size_t* size);
+int read_script(const char* path, script_event** events);
+uint32_t ram_hash();
+bool dump_ram(int job);
+void run_job(int job, worker_cache* cache);
+void report(const char* fmt, ...);
+void fail(int job, const char* error);
+void* worker_main(void* arg);
+
+// --------------------
+// Function definitions
+// --------------------
+
+int read_jobs(const char* list) {
+   FILE* f = fopen(list, "r");
+   if (f == NULL) {
+      return -1;
+   }
+   char line[PATH_LEN * 2 + 32];
+   char rom[PATH_LEN];
+   char script[PATH_LEN];
+   int size    = 0;
+   batch_count = 0;
+   while (fgets(line, sizeof(line), f) != NULL) {
+      int frames = 0;
+      int fields = sscanf(line, "%1023s %d %1023s", rom, &frames, script);
+      if (fields < 2 || rom[0] == '#' || frames < 1) {
+         continue;
+      }
+      if (batch_count == size) {
+         size       = size ? size * 2 : 64;
+         batch_jobs = realloc(batch_jobs, size * sizeof(batch_job));
+      }
+      batch_job* job = &batch_jobs[batch_count++];
+      job->rom       = strdup(rom);
+      job->frames    = frames;
+      job->script    = fields == 3 ? strdup(script) : NULL;
+   }
+   fclose(f);
+   return batch_count;
+}
+
+// Takes the worker's next job, or steals one. Returns -1 when every
+// deque is empty, which means all jobs have been handed out.
+int next_job(int self) {
+   job_deque* own = &deques[self];
+   int job        = -1;
+   pthread_mutex_lock(&own->lock);
+   if (own->bottom > own->top) {
+      job = --own->bottom;
+   }
+   pthread_mutex_unlock(&own->lock);
+
+   for (int i = 1; job < 0 && i < worker_count; ++i) {
+      job_deque* victim = &deques[(self + i) % worker_count];
+      pthread_mutex_lock(&victim->lock);
+      if (victim->bottom > victim->top) {
+         job = victim->top++;
+      }
+      pthread_mutex_unlock(&victim->lock);
+   }
+   return job;
+}
+
+byte* read_file(const char* path, size_t* size) {
+   FILE* f = fopen(path, "rb");
+   if (f == NULL) {
+      return NULL;
+   }
+   fseek(f, 0, SEEK_END);
+   long len = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   byte* data = len > 0 ? malloc(len) : NULL;
+   if (data != NULL && fread(data, 1, len, f) != (size_t)len) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+   *size = len;
+   return data;
+}
+
+// Returns the number of events read, or -1 if the script is bad
+int read_script(const char* path, script_event** events) {
+   FILE* f = fopen(path, "r");
+   if (f == NULL) {
+      return -1;
+   }
+   char name[16];
+   char state[8];
+   int frame = 0;
+   int count = 0;
+   int size  = 0;
+   *events   = NULL;
+   while (fscanf(f, "%d %15s %7s", &frame, name, state) == 3) {
+      if (count == size) {
+         size    = size ? size * 2 : 64;
+         *events = realloc(*events, size * sizeof(script_event));
+      }
+      script_event* e = &(*events)[count];
+      e->frame        = frame;
+      e->pressed      = strcmp(state, "down") == 0;
+      e->mask         = 0;
+      for (int b = 0; b < BUTTON_COUNT; ++b) {
+         if (strcmp(name, script_buttons[b].name) == 0) {
+            e->kind = script_buttons[b].kind;
+            e->mask = script_buttons[b].mask;
+         }
+      }
+      if (e->mask == 0 || (!e->pressed && strcmp(state, "up") != 0)) {
+         break;
+      }
+      count++;
+   }
+   bool done = feof(f);
+   fclose(f);
+   if (!done) {
+      free(*events);
+      *events = NULL;
+      return -1;
+   }
+   return count;
+}
+
+// FNV-1a over work RAM and high RAM
+uint32_t ram_hash() {
+   uint32_t h       = 2166136261u;
+   const byte* wram = mem_ptr(0xC000);
+   const byte* hram = mem_ptr(0xFF80);
+   for (int i = 0; i < 0x2000; ++i) {
+      h = (h ^ wram[i]) * 16777619u;
+   }
+   for (int i = 0; i < 0x7F; ++i) {
+      h = (h ^ hram[i]) * 16777619u;
+   }
+   return h;
+}
+
+bool dump_ram(int job) {
+   char path[PATH_LEN];
+   snprintf(path, sizeof(path), "%s/%d.ram", ram_dump_dir, job);
+   FILE* f = fopen(path, "wb");
+   if (f == NULL) {
+      return false;
+   }
+   fwrite(mem_ptr(0xC000), 1, 0x2000, f);
+   fwrite(mem_ptr(0xFF80), 1, 0x7F, f);
+   fclose(f);
+   return true;
+}
+
+// Writes one line of results. Lines from different workers never
+// interleave, and each is flushed so results stream out.
+void report(const char* fmt, ...) {
+   va_list args;
+   va_start(args, fmt);
+   pthread_mutex_lock(&result_lock);
+   vfprintf(result_out, fmt, args);
+   fflush(result_out);
+   pthread_mutex_unlock(&result_lock);
+   va_end(args);
+}
+
+void fail(int job, const char* error) {
+   report("%d %s ERROR %s\n", job, batch_jobs[job].rom, error);
+   pthread_mutex_lock(&result_lock);
+   failed_jobs++;
+   pthread_mutex_unlock(&result_lock);
+}
+
+void run_job(int job, worker_cache* cache) {
+   batch_job* j = &batch_jobs[job];
+
+   // Jobs often share a ROM, so the last one stays loaded
+   if (cache->data == NULL || strcmp(cache->rom, j->rom) != 0) {
+      free(cache->data);
+      cache->data   = read_file(j->rom, &cache->size);
+      cache->booted = false;
+      snprintf(cache->rom, PATH_LEN, "%s", j->rom);
+   }
+   script_event* events = NULL;
+   int event_count      = 0;
+   if (j->script != NULL) {
+      event_count = read_script(j->script, &events);
+   }
+   const char* error = NULL;
+   if (cache->data == NULL) {
+      error = "couldn't read ROM";
+   } else if (event_count < 0) {
+      error = "bad input script";
+   } else if (cache->booted) {
+      gb_reset();
+   } else if (!gb_init_rom(cache->data, cache->size)) {
+      error = "bad ROM";
+   } else {
+      cache->booted = true;
+   }
+   if (error != NULL) {
+      fail(job, error);
+      free(events);
+      return;
+   }
+
+   // Nothing is shown, so only the last frame gets drawn
+   lcd_set_frame_skip(LCD_RENDER_ON_DEMAND);
+   int next = 0;
+   for (int f = 0; f < j->frames; ++f) {
+      while (next < event_count && events[next].frame <= f) {
+         script_event* e = &events[next++];
+         input_push(cpu_ticks, e->kind, e->mask, e->pressed);
+      }
+      if (f == j->frames - 1) {
+         lcd_request_frame();
+      }
+      gb_run_frame();
+   }
+   free(events);
+
+   if (ram_dump_dir != NULL && !dump_ram(job)) {
+      fail(job, "couldn't write RAM dump");
+      return;
+   }
+   const char* result = "-";
+   if (cpu_test_result == TEST_PASSED) {
+      result = "PASS";
+   } else if (cpu_test_result == TEST_FAILED) {
+      result = "FAIL";
+   }
+   report("%d %s %d %lld %08X %08X %s\n",
+         job,
+         j->rom,
+         j->frames,
+         (long long)cpu_ticks * 4,
+         golden_hash(lcd_get_framebuffer()),
+         ram_hash(),
+         result);
+}
+
+void* worker_main(void* arg) {
+   int self           = (int)(intptr_t)arg;
+   worker_cache cache = {"", NULL, 0, false};
+   bool ran           = false;
+   int job;
+   while ((job = next_job(self)) >= 0) {
+      run_job(job, &cache);
+      ran = true;
+   }
+   free(cache.data);
+   if (ran) {
+      gb_free();
+   }
+   return NULL;
+}
+
+int batch_run(const char* list, FILE* out, int threads, const char* dump_dir) {
+   if (read_jobs(list) < 0) {
+      fprintf(stderr, "Couldn't read job list %s\n", list);
+      return 1;
+   }
+   if (threads < 1) {
+      threads = sysconf(_SC_NPROCESSORS_ONLN);
+   }
+   if (threads > batch_count) {
+      threads = batch_count;
+   }
+   if (threads > MAX_WORKERS) {
+      threads = MAX_WORKERS;
+   }
+   worker_count = threads;
+   result_out   = out;
+   ram_dump_dir = dump_dir;
+   failed_jobs  = 0;
+   pthread_mutex_init(&result_lock, NULL);
+   fprintf(out, "# job rom frames cycles frame_hash ram_hash result\n");
+
+   pthread_t workers[MAX_WORKERS];
+   for (int w = 0; w < worker_count; ++w) {
+      deques[w].top    = batch_count * w / worker_count;
+      deques[w].bottom = batch_count * (w + 1) / worker_count;
+      pthread_mutex_init(&deques[w].lock, NULL);
+   }
+   for (int w = 0; w < worker_count; ++w) {
+      pthread_create(&workers[w], NULL, worker_main, (void*)(intptr_t)w);
+   }
+   for (int w = 0; w < worker_count; ++w) {
+      pthread_join(workers[w], NULL);
+      pthread_mutex_destroy(&deques[w].lock);
+   }
+   pthread_mutex_destroy(&result_lock);
+
+   for (int j = 0; j < batch_count; ++j) {
+      free(batch_jobs[j].rom);
+      free(batch_jobs[j].script);
+   }
+   free(batch_jobs);
+   batch_jobs = NULL;
+   return failed_jobs;
+}
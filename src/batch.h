@@ -0,0 +1,25 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "defines.h"
+
+// Runs a list of jobs, each a ROM, a frame count and an optional
+// input script, on a pool of worker threads. Every worker runs its
+// own Game Boy and reuses its memory from one job to the next. Jobs
+// on the ROM a worker already has loaded start with gb_reset.
+//
+// The job list has one "rom frames [script]" line per job. Scripts
+// have one "frame button down|up" line per input event, where button
+// is a, b, select, start, right, left, up or down. Events apply at
+// the start of the given frame.
+//
+// One line per job is written to out as jobs finish:
+// "job rom frames cycles frame_hash ram_hash result". ram_hash covers
+// work RAM and high RAM, and result is the Mooneye test outcome.
+// With dump_dir set, those bytes are also saved as <dir>/<job>.ram.
+
+// Returns the number of jobs that failed to run. threads of 0 uses
+// one per CPU.
+int batch_run(const char* list, FILE* out, int threads, const char* dump_dir);
+
+#endif
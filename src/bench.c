@@ -0,0 +1,158 @@
+#include "bench.h"
+#include "cpu.h"
+#include "gb.h"
+#include "lcd.h"
+#include "pacing.h"
+#include "present.h"
+#include "runahead.h"
+#include "timing.h"
+#include "trace.h"
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define PRESENT_SCALE 2
+
+// ------------------
+// Internal functions
+// ------------------
+
+int compare_frame_ns(const void* a, const void* b);
+void print_json_string(FILE* out, const char* str);
+
+// --------------------
+// Function definitions
+// --------------------
+
+int compare_frame_ns(const void* a, const void* b) {
+   int64_t x = *(const int64_t*)a;
+   int64_t y = *(const int64_t*)b;
+   return (x > y) - (x < y);
+}
+
+bench_result bench_run(int frames, bool render, bool present) {
+   bench_result r = {0};
+   int64_t* times = malloc(frames * sizeof(int64_t));
+   uint32_t* src  = NULL;
+   uint32_t* dst  = NULL;
+   if (present) {
+      src = calloc(160 * 144, sizeof(uint32_t));
+      dst = malloc(160 * 144 * PRESENT_SCALE * PRESENT_SCALE
+            * sizeof(uint32_t));
+      lcd_set_output(LCD_XRGB8888, src, 160 * sizeof(uint32_t));
+   }
+   // Running ahead draws the one frame it shows itself
+   bool draw = (render || present) && runahead_frames() == 0;
+   lcd_set_frame_skip(draw ? 0 : LCD_RENDER_ON_DEMAND);
+
+   cycle start_ticks   = cpu_ticks;
+   int64_t start_instr = cpu_instructions;
+   int64_t start       = pacing_now();
+   int64_t prev        = start;
+   for (int f = 0; f < frames; ++f) {
+      gb_run_frame();
+      runahead_run();
+      if (trace_on) {
+         trace_host("Emulate", prev, pacing_now());
+      }
+      if (present) {
+         int64_t shown = pacing_now();
+         TIMING_BEGIN(ZONE_PRESENT);
+         lcd_sync();
+         present_frame(src,
+               (byte*)dst,
+               160 * PRESENT_SCALE * sizeof(uint32_t),
+               PRESENT_SCALE,
+               PRESENT_NEAREST);
+         TIMING_END();
+         if (trace_on) {
+            trace_host("Present", shown, pacing_now());
+         }
+      }
+      int64_t now = pacing_now();
+      times[f]    = now - prev;
+      prev        = now;
+   }
+
+   r.frames       = frames;
+   r.cycles       = (cpu_ticks - start_ticks) * 4;
+   r.instructions = cpu_instructions - start_instr;
+   r.total_ns     = prev - start;
+   qsort(times, frames, sizeof(int64_t), compare_frame_ns);
+   r.min_ns    = times[0];
+   r.median_ns = times[(frames - 1) / 2];
+   r.p99_ns    = times[(frames - 1) * 99 / 100];
+   r.max_ns    = times[frames - 1];
+   r.ahead      = runahead_frames();
+   r.ahead_cost = runahead_get_cost();
+
+   if (present) {
+      lcd_set_output(LCD_GREY8, NULL, 0);
+      free(src);
+      free(dst);
+   }
+   free(times);
+   return r;
+}
+
+void bench_print(FILE* out, const char* name, const bench_result* r) {
+   double secs = r->total_ns / 1e9;
+   fprintf(out, "%s\n", name);
+   fprintf(out, "  frames        %d in %.3f s\n", r->frames, secs);
+   fprintf(out, "  fps           %.1f\n", r->frames / secs);
+   fprintf(out,
+         "  speed         %.2f MHz (%.1fx)\n",
+         r->cycles / secs / 1e6,
+         r->cycles / secs / CYCLES_PER_SECOND);
+   fprintf(out, "  instructions  %.2f M/s\n", r->instructions / secs / 1e6);
+   fprintf(out,
+         "  frame time    min %.1f us, median %.1f us, p99 %.1f us\n",
+         r->min_ns / 1e3,
+         r->median_ns / 1e3,
+         r->p99_ns / 1e3);
+}
+
+void print_json_string(FILE* out, const char* str) {
+   fputc('"', out);
+   for (; *str; ++str) {
+      if (*str == '"' || *str == '\\') {
+         fputc('\\', out);
+      }
+      fputc(*str, out);
+   }
+   fputc('"', out);
+}
+
+// One object per line, so results from several runs can be
+// appended to the same file
+void bench_print_json(FILE* out, const char* name, const bench_result* r) {
+   double secs = r->total_ns / 1e9;
+   fprintf(out, "{\"rom\": ");
+   print_json_string(out, name);
+   fprintf(out,
+         ", \"frames\": %d, \"seconds\": %.6f, \"fps\": %.3f, "
+         "\"mhz\": %.4f, \"instructions_per_sec\": %.0f, "
+         "\"frame_ns\": {\"min\": %" PRId64 ", \"median\": %" PRId64
+         ", \"p99\": %" PRId64 ", \"max\": %" PRId64 "}",
+         r->frames,
+         secs,
+         r->frames / secs,
+         r->cycles / secs / 1e6,
+         r->instructions / secs,
+         r->min_ns,
+         r->median_ns,
+         r->p99_ns,
+         r->max_ns);
+   if (r->ahead > 0 && r->ahead_cost.frames > 0) {
+      const runahead_cost* c = &r->ahead_cost;
+      fprintf(out,
+            ", \"run_ahead\": {\"frames\": %d, \"mean_ns\": %" PRId64
+            ", \"max_ns\": %" PRId64 ", \"state_ns\": %" PRId64 "}",
+            r->ahead,
+            c->total_ns / c->frames,
+            c->max_ns,
+            c->state_ns / c->frames);
+   }
+   fprintf(out, "}\n");
+}
@@ -0,0 +1,31 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "defines.h"
+#include "runahead.h"
+
+// Runs the loaded ROM as fast as possible and measures how quickly
+// frames are emulated.
+
+typedef struct bench_result_ {
+   int frames;
+   int64_t cycles;       // T-cycles emulated
+   int64_t instructions;
+   int64_t total_ns;     // Host time for all frames
+   int64_t min_ns;       // Host time per emulated frame
+   int64_t median_ns;
+   int64_t p99_ns;
+   int64_t max_ns;
+   int ahead;            // Frames run ahead, or 0
+   runahead_cost ahead_cost;
+} bench_result;
+
+// With render off, the LCD draws nothing. With present on, every
+// frame is also scaled up the way the GUI would show it. If running
+// ahead is on, it runs after every frame, and draws what it shows
+// whatever render says.
+bench_result bench_run(int frames, bool render, bool present);
+void bench_print(FILE* out, const char* name, const bench_result* r);
+void bench_print_json(FILE* out, const char* name, const bench_result* r);
+
+#endif
@@ -1,8 +1,16 @@
 #include "cpu.h"
 #include "apu.h"
 #include "debugger.h"
+#include "input.h"
 #include "lcd.h"
 #include "memory.h"
+#include "opstats.h"
+#include "profiler.h"
+#include "timing.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <string.h>
 
 // ----------------
 // Internal defines
@@ -18,15 +26,24 @@
 // Internal variables
 // ------------------
 
-cpu_state cpu;
-byte last_op;
-word last_pc;
-word system_timer;
-bool prev_timer;
-bool fire_tima;
-
-// Array of opcode function pointers
+_Thread_local cpu_state cpu;
+_Thread_local cycle cpu_ticks;
+_Thread_local int64_t cpu_instructions;
+_Thread_local test_result cpu_test_result;
+_Thread_local byte last_op;
+_Thread_local word last_pc;
+_Thread_local byte last_cb_op; // Only kept up to date with OPCODE_STATS
+_Thread_local word system_timer;
+_Thread_local bool prev_timer;
+_Thread_local bool fire_tima;
+
+// Indexed by (vector - 0x40) / 8
+const char* interrupt_names[] = {"VBLANK", "STAT", "TIMA", "Serial", "Input"};
+
+// Array of opcode function pointers. It's the same for every Game
+// Boy, so it's built once and shared by all threads.
 void (*cpu_opcodes[0x100])();
+pthread_once_t op_table_once = PTHREAD_ONCE_INIT;
 
 // All opcodes are defined in another file, but
 // they require the above variable declarations
@@ -37,13 +54,16 @@ void (*cpu_opcodes[0x100])();
 // ------------------
 
 void build_op_table();
+#ifdef GUEST_PROFILE
+void profile_step(word pc, word sp, cycle start, bool raised);
+#endif
 
 // --------------------
 // Function definitions
 // --------------------
 
 void cpu_init() {
-   build_op_table();
+   pthread_once(&op_table_once, build_op_table);
    fire_tima    = false;
    system_timer = 0;
    prev_timer = false;
@@ -75,6 +95,16 @@ void cpu_reset() {
    system_timer  = 0;
    prev_timer    = false;
 
+   cpu_instructions = 0;
+   cpu_test_result  = TEST_RUNNING;
+   // Both are process wide, so only touched when built in
+#ifdef OPCODE_STATS
+   opstats_reset();
+#endif
+#ifdef GUEST_PROFILE
+   profiler_reset();
+#endif
+
    // Setup our in-memory registers
    wbyte(0xFF02, 0x7E); // Serial Transfer Control
    wbyte(0xFF05, 0x00); // TIMA
@@ -114,12 +144,67 @@ cpu_state cpu_get_state() {
    return cpu;
 }
 
+void cpu_save_state(cpu_snapshot* s) {
+   byte flags = (cpu.zf ? BITMASK_Z : 0) | (cpu.nf ? BITMASK_N : 0)
+                | (cpu.hf ? BITMASK_H : 0) | (cpu.cf ? BITMASK_C : 0);
+   s->ticks        = cpu_ticks;
+   s->instructions = cpu_instructions;
+   s->pc           = cpu.pc;
+   s->sp           = cpu.sp;
+   s->system_timer = system_timer;
+   s->a            = cpu.a;
+   s->f            = flags;
+   s->b            = cpu.b;
+   s->c            = cpu.c;
+   s->d            = cpu.d;
+   s->e            = cpu.e;
+   s->h            = cpu.h;
+   s->l            = cpu.l;
+   s->halted       = cpu.halted;
+   s->stopped      = cpu.stopped;
+   s->ime          = cpu.ime;
+   s->ime_delay    = cpu.ime_delay;
+   s->prev_timer   = prev_timer;
+   s->fire_tima    = fire_tima;
+   s->test_result  = cpu_test_result;
+   memset(s->unused, 0, sizeof(s->unused));
+}
+
+// The op table must already be built by cpu_init
+void cpu_load_state(const cpu_snapshot* s) {
+   cpu_ticks        = s->ticks;
+   cpu_instructions = s->instructions;
+   cpu.pc           = s->pc;
+   cpu.sp           = s->sp;
+   system_timer     = s->system_timer;
+   cpu.a            = s->a;
+   cpu.zf           = s->f & BITMASK_Z;
+   cpu.nf           = s->f & BITMASK_N;
+   cpu.hf           = s->f & BITMASK_H;
+   cpu.cf           = s->f & BITMASK_C;
+   cpu.b            = s->b;
+   cpu.c            = s->c;
+   cpu.d            = s->d;
+   cpu.e            = s->e;
+   cpu.h            = s->h;
+   cpu.l            = s->l;
+   cpu.halted       = s->halted;
+   cpu.stopped      = s->stopped;
+   cpu.ime          = s->ime;
+   cpu.ime_delay    = s->ime_delay;
+   prev_timer       = s->prev_timer;
+   fire_tima        = s->fire_tima;
+   cpu_test_result  = s->test_result;
+}
+
 void cpu_reset_timer() {
    system_timer = 0;
 }
 
 void cpu_advance_time(cycle dt) {
+   TIMING_BEGIN(ZONE_LCD);
    lcd_advance_time(dt);
+   TIMING_END();
    mem_advance_time(dt);
    apu_advance_time(dt);
 
@@ -140,6 +225,7 @@ void cpu_advance_time(cycle dt) {
          timer_bit <<= 7;
          break;
    }
+   TIMING_BEGIN(ZONE_TIMER);
    for (int i = 0; i < dt / 4; ++i) {
       system_timer += 4;
       cpu_ticks++;
@@ -167,9 +253,23 @@ void cpu_advance_time(cycle dt) {
       prev_timer = test_val != 0;
    }
    dwrite(DIV, system_timer >> 8);
+   TIMING_END();
 }
 
 void cpu_execute_step() {
+   TIMING_BEGIN(ZONE_CPU);
+
+   // Apply any queued input that is due by now
+   if (cpu_ticks >= input_due) {
+      input_update(cpu_ticks);
+   }
+
+#ifdef GUEST_PROFILE
+   cycle prof_start = cpu_ticks;
+   word prof_pc     = cpu.pc;
+   word prof_sp     = cpu.sp;
+#endif
+
    // Check interrupts
    bool raised = false;
    byte inte   = dread(IE);
@@ -178,6 +278,9 @@ void cpu_execute_step() {
 
    if (irq && cpu.halted) {
       cpu.halted = false;
+      if (trace_on) {
+         trace_end(TRACK_CPU);
+      }
       if (cpu.ime) {
          cpu.ime_delay = false;
       }
@@ -219,6 +322,11 @@ void cpu_execute_step() {
          if (target != 0x00) {
             raised  = true;
             cpu.ime = false;
+            if (trace_on) {
+               trace_instant(TRACK_INTERRUPT,
+                     interrupt_names[(target - 0x40) / 8],
+                     target);
+            }
             PUSHW(cpu.pc);
             TIME(2);
             cpu.pc = target;
@@ -233,13 +341,76 @@ void cpu_execute_step() {
       if (!cpu.halted && !cpu.stopped) {
          last_pc = cpu.pc;
          last_op = rbyte(cpu.pc++);
+#ifdef OPCODE_STATS
+         cycle start = cpu_ticks;
          (*cpu_opcodes[last_op])();
+         op_stat* stat = &op_stats[last_op == 0xCB ? 0x100 | last_cb_op
+                                                   : last_op];
+         stat->count++;
+         stat->cycles += (cpu_ticks - start) * 4;
+#else
+         (*cpu_opcodes[last_op])();
+#endif
+         cpu_instructions++;
          dbg_notify_exec(cpu.pc);
       } else {
          cpu_nop();
       }
    }
+#ifdef GUEST_PROFILE
+   profile_step(prof_pc, prof_sp, prof_start, raised);
+#endif
+   TIMING_END();
+}
+
+#ifdef GUEST_PROFILE
+// Tells the profiler where the last step's cycles went, and follows
+// calls and returns by how they moved the stack pointer
+void profile_step(word pc, word sp, cycle start, bool raised) {
+   cycle cycles = (cpu_ticks - start) * 4;
+   if (raised) {
+      profiler_call(cpu.pc, cpu.sp, true);
+      profiler_cycles(cpu.pc, cycles, false);
+      return;
+   }
+   bool idle = (cpu.halted || cpu.stopped) && cpu.pc == pc;
+   profiler_cycles(pc, cycles, idle);
+   if (idle) {
+      return;
+   }
+   switch (last_op) {
+      case 0xC4: // CALL cc, nn
+      case 0xCC:
+      case 0xCD: // CALL nn
+      case 0xD4:
+      case 0xDC:
+      case 0xC7: // RST
+      case 0xCF:
+      case 0xD7:
+      case 0xDF:
+      case 0xE7:
+      case 0xEF:
+      case 0xF7:
+      case 0xFF:
+         if (cpu.sp == (word)(sp - 2)) {
+            profiler_call(cpu.pc, cpu.sp, false);
+         }
+         break;
+      case 0xC0: // RET cc
+      case 0xC8:
+      case 0xD0:
+      case 0xD8:
+      case 0xC9: // RET
+      case 0xD9: // RETI
+         if (cpu.sp == (word)(sp + 2)) {
+            profiler_ret(sp);
+         }
+         break;
+      default:
+         break;
+   }
 }
+#endif
 
 void build_op_table() {
    for (size_t i = 0; i < 0x100; i++) {
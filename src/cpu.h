@@ -16,9 +16,44 @@ typedef struct cpu_state_ {
 } cpu_state;
 
 // This is used to track time in the debugger
-cycle cpu_ticks;
+extern _Thread_local cycle cpu_ticks;
+
+typedef enum test_result_ {
+   TEST_RUNNING,
+   TEST_PASSED,
+   TEST_FAILED
+} test_result;
+
+// Set when a test ROM reports a result, with LD B,B for Mooneye's
+// or over the link cable for Blargg's
+extern _Thread_local test_result cpu_test_result;
+
+// Instructions executed since the last reset, not counting
+// steps spent halted
+extern _Thread_local int64_t cpu_instructions;
+
+// Everything needed to pick the CPU and timers up where they left
+// off. Part of the save state format, so the layout is fixed.
+typedef struct cpu_snapshot_ {
+   int64_t ticks;
+   int64_t instructions;
+   word pc;
+   word sp;
+   word system_timer;
+   byte a, f, b, c, d, e, h, l; // f holds the flags as PUSH AF does
+   byte halted;
+   byte stopped;
+   byte ime;
+   byte ime_delay;
+   byte prev_timer;
+   byte fire_tima;
+   byte test_result;
+   byte unused[3];
+} cpu_snapshot;
 
 cpu_state cpu_get_state();
+void cpu_save_state(cpu_snapshot* s);
+void cpu_load_state(const cpu_snapshot* s);
 void cpu_execute_step();
 void cpu_init();
 void cpu_reset();
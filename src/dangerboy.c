@@ -0,0 +1,146 @@
+#include "dangerboy.h"
+#include "cpu.h"
+#include "gb.h"
+#include "lcd.h"
+#include "memory.h"
+#include "rewind.h"
+
+// ----------------
+// Internal defines
+// ----------------
+
+// Everything else about a Game Boy is in the thread's own state
+struct dangerboy_ {
+   bool loaded;
+};
+
+// ------------------
+// Internal variables
+// ------------------
+
+_Thread_local dangerboy* thread_gb;
+
+// --------------------
+// Function definitions
+// --------------------
+
+dangerboy* dangerboy_create(void) {
+   if (thread_gb != NULL) {
+      return NULL;
+   }
+   thread_gb = calloc(1, sizeof(dangerboy));
+   return thread_gb;
+}
+
+void dangerboy_destroy(dangerboy* gb) {
+   if (gb == NULL) {
+      return;
+   }
+   gb_free();
+   free(gb);
+   thread_gb = NULL;
+}
+
+bool dangerboy_load_rom(dangerboy* gb, const uint8_t* data, size_t size) {
+   gb->loaded = gb_init_rom(data, size);
+   return gb->loaded;
+}
+
+void dangerboy_reset(dangerboy* gb) {
+   if (gb->loaded) {
+      gb_reset();
+   }
+}
+
+void dangerboy_run_frame(dangerboy* gb) {
+   if (gb->loaded) {
+      gb_run_frame();
+      rewind_capture();
+   }
+}
+
+int64_t dangerboy_run_cycles(dangerboy* gb, int64_t cycles) {
+   if (!gb->loaded) {
+      return 0;
+   }
+   cycle start = cpu_ticks;
+   cycle end   = start + (cycles + 3) / 4;
+   while (cpu_ticks < end) {
+      gb_step();
+      // Keeps the frame flag from ending the next run_frame early
+      if (gb_frame_done()) {
+         rewind_capture();
+      }
+   }
+   return (cpu_ticks - start) * 4;
+}
+
+int64_t dangerboy_cycles(dangerboy* gb) {
+   return gb->loaded ? cpu_ticks * 4 : 0;
+}
+
+void dangerboy_set_input(dangerboy* gb, uint8_t buttons) {
+   if (!gb->loaded) {
+      return;
+   }
+   byte held     = joypad_held();
+   byte pressed  = buttons & ~held;
+   byte released = held & ~buttons;
+   if (pressed & 0x0F) {
+      press_button(pressed & 0x0F);
+   }
+   if (pressed & 0xF0) {
+      press_dpad(pressed >> 4);
+   }
+   release_button(released & 0x0F);
+   release_dpad(released >> 4);
+}
+
+void dangerboy_set_rendering(dangerboy* gb, bool on) {
+   lcd_set_frame_skip(on ? 0 : LCD_RENDER_ON_DEMAND);
+}
+
+const uint8_t* dangerboy_framebuffer(dangerboy* gb) {
+   return gb->loaded ? lcd_get_framebuffer() : NULL;
+}
+
+bool dangerboy_set_rewind(dangerboy* gb, int frames, size_t bytes) {
+   return rewind_init(frames, bytes);
+}
+
+bool dangerboy_rewind(dangerboy* gb) {
+   return gb->loaded && rewind_step();
+}
+
+size_t dangerboy_state_size(void) {
+   return sizeof(gb_state);
+}
+
+// The buffer is used as a gb_state in place, so it must be aligned
+bool dangerboy_save_state(dangerboy* gb, void* buffer, size_t size) {
+   if (!gb->loaded || size < sizeof(gb_state)
+         || (uintptr_t)buffer % _Alignof(gb_state) != 0) {
+      return false;
+   }
+   gb_save_state(buffer);
+   return true;
+}
+
+bool dangerboy_load_state(dangerboy* gb, const void* buffer, size_t size) {
+   if (!gb->loaded || size < sizeof(gb_state)
+         || (uintptr_t)buffer % _Alignof(gb_state) != 0) {
+      return false;
+   }
+   return gb_load_state(buffer);
+}
+
+uint32_t dangerboy_update_state(dangerboy* gb,
+      void* buffer,
+      size_t size,
+      uint32_t since) {
+   if (!gb->loaded || size < sizeof(gb_state)
+         || (uintptr_t)buffer % _Alignof(gb_state) != 0) {
+      return 0;
+   }
+   return gb_update_state(buffer, since, NULL);
+}
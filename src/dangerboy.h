@@ -0,0 +1,117 @@
+#ifndef __DANGERBOY_H__
+#define __DANGERBOY_H__
+
+// The public interface of libdangerboy. This is the only header a
+// program linking the library needs, and nothing in it changes
+// without DANGERBOY_API_VERSION changing too.
+//
+// Emulator state is kept per thread, so each thread can run one
+// Game Boy. A dangerboy must be used only on the thread that
+// created it. No call allocates memory except dangerboy_create
+// and dangerboy_load_rom.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DANGERBOY_API_VERSION 1
+
+#if defined(__GNUC__)
+#define DANGERBOY_API __attribute__((visibility("default")))
+#else
+#define DANGERBOY_API
+#endif
+
+#define DANGERBOY_WIDTH 160
+#define DANGERBOY_HEIGHT 144
+
+// T-cycles per second, and per frame with the LCD on
+#define DANGERBOY_CLOCK 4194304
+#define DANGERBOY_FRAME_CYCLES 70224
+
+// Buttons for dangerboy_set_input, or'd together
+#define DANGERBOY_A 0x01
+#define DANGERBOY_B 0x02
+#define DANGERBOY_SELECT 0x04
+#define DANGERBOY_START 0x08
+#define DANGERBOY_RIGHT 0x10
+#define DANGERBOY_LEFT 0x20
+#define DANGERBOY_UP 0x40
+#define DANGERBOY_DOWN 0x80
+
+typedef struct dangerboy_ dangerboy;
+
+// Returns NULL if this thread already has a Game Boy
+DANGERBOY_API dangerboy* dangerboy_create(void);
+DANGERBOY_API void dangerboy_destroy(dangerboy* gb);
+
+// Loads a cartridge and powers on. The data is copied. Returns
+// false if it isn't a usable ROM, which leaves nothing loaded.
+DANGERBOY_API bool dangerboy_load_rom(dangerboy* gb,
+      const uint8_t* data,
+      size_t size);
+
+// Powers back on with the same ROM. This copies a snapshot taken at
+// power on, so it is cheap enough to run millions of short episodes.
+DANGERBOY_API void dangerboy_reset(dangerboy* gb);
+
+// Run until the next frame is complete
+DANGERBOY_API void dangerboy_run_frame(dangerboy* gb);
+
+// Runs at least the given number of T-cycles, stopping at the end
+// of an instruction. Returns how many were run.
+DANGERBOY_API int64_t dangerboy_run_cycles(dangerboy* gb, int64_t cycles);
+
+// T-cycles since power on
+DANGERBOY_API int64_t dangerboy_cycles(dangerboy* gb);
+
+// Sets which buttons are held, taking effect immediately
+DANGERBOY_API void dangerboy_set_input(dangerboy* gb, uint8_t buttons);
+
+// Skipping drawing saves most of the LCD's cost when only the
+// machine state matters. Drawing is on by default.
+DANGERBOY_API void dangerboy_set_rendering(dangerboy* gb, bool on);
+
+// The last complete frame, one byte per pixel, row by row. Shades
+// run from 0xFE (white) to 0x00 (black). The frame stays put until
+// this is called again. NULL before a ROM is loaded.
+DANGERBOY_API const uint8_t* dangerboy_framebuffer(dangerboy* gb);
+
+// Keeps the last frames captures of the machine, one per frame, in
+// at most bytes of memory. Only what changed since the frame before
+// is kept, so a few hundred bytes a frame is typical. 0 for either
+// turns it off, which is the default. Returns false if it couldn't
+// allocate the memory.
+DANGERBOY_API bool dangerboy_set_rewind(dangerboy* gb,
+      int frames,
+      size_t bytes);
+
+// Goes back one frame. Returns false when there is no history left.
+DANGERBOY_API bool dangerboy_rewind(dangerboy* gb);
+
+// Save states are dangerboy_state_size bytes, in a buffer aligned
+// at least as well as malloc's. They are the same as the state files
+// the frontends write, and carry a format version, so they load into
+// any build using the same version and the same ROM. Both return
+// false if the buffer won't do, or there is no ROM or it doesn't
+// match.
+DANGERBOY_API size_t dangerboy_state_size(void);
+DANGERBOY_API bool dangerboy_save_state(dangerboy* gb,
+      void* buffer,
+      size_t size);
+DANGERBOY_API bool dangerboy_load_state(dangerboy* gb,
+      const void* buffer,
+      size_t size);
+
+// Brings a save state up to date, copying only the memory written
+// since the call that returned since. The buffer must still hold
+// what that call left in it. Pass 0 the first time, which saves
+// everything. Returns what to pass next time, or 0 if the buffer
+// won't do. Keeping a state each frame this way costs about as much
+// as the frame's memory writes, rather than copying 96KB.
+DANGERBOY_API uint32_t dangerboy_update_state(dangerboy* gb,
+      void* buffer,
+      size_t size,
+      uint32_t since);
+
+#endif
@@ -3,6 +3,7 @@
 #include "disas.h"
 #include "lcd.h"
 #include "memory.h"
+#include "opstats.h"
 
 #include <ncurses.h>
 #include <stdio.h>
@@ -17,7 +18,7 @@ struct BreakpointEntry {
    byte watch_value;
 };
 
-cpu_state cpu;
+static cpu_state cpu; // Copy of the CPU state as of the last break
 word memory_view_addr;
 char cmd[256];
 byte a, b, c, d, e, h, l;
@@ -260,6 +261,7 @@ void dbg_cli() {
       init_curses();
       curses_on = true;
    }
+   cpu = cpu_get_state();
 
    // Print prompt
    print_reg_diff();
@@ -315,7 +317,36 @@ bool handle_input(const char* str) {
    if (sc(inp, "help") || sc(inp, "h") || sc(inp, "?")) {
       wprintw(console_pane, "Available commands:\n");
       wprintw(console_pane,
-            "\tquit\n\tstep\n\tmem\n\tdisas\n\tbreak\n\tbreakop\n\tcontinue\n");
+            "\tquit\n\tstep\n\tmem\n\tdisas\n\tbreak\n\tbreakop\n\tcontinue\n"
+            "\tops\n");
+      return false;
+   }
+
+   // Opcode histogram
+   if (sc(inp, "ops")) {
+#ifdef OPCODE_STATS
+      if (args != NULL && sc(args, "reset")) {
+         opstats_reset();
+         wprintw(console_pane, "Opcode counts cleared\n");
+         return false;
+      }
+      int shown = args == NULL ? 16 : atoi(args);
+      op_stat sorted[OPSTATS_COUNT];
+      int count = opstats_sorted(sorted);
+      for (int i = 0; i < count && i < shown; ++i) {
+         if (sorted[i].op >= 0x100) {
+            wprintw(console_pane, "CB %02X", sorted[i].op & 0xFF);
+         } else {
+            wprintw(console_pane, "   %02X", sorted[i].op);
+         }
+         wprintw(console_pane,
+               " %12lld runs %14lld cycles\n",
+               (long long)sorted[i].count,
+               (long long)sorted[i].cycles);
+      }
+#else
+      wprintw(console_pane, "Build with OPCODE_STATS to count opcodes\n");
+#endif
       return false;
    }
 
@@ -17,6 +17,31 @@
    if (has_colors()) \
       wattrset((w), COLOR_PAIR(x));
 
+#ifdef HEADLESS
+
+// Headless builds leave out the debugger and ncurses entirely
+static inline bool dbg_should_break() {
+   return false;
+}
+static inline void dbg_cli() {
+}
+static inline void dbg_break() {
+}
+static inline void dbg_init() {
+}
+static inline void dbg_free() {
+}
+static inline void dbg_log(const char* str) {
+}
+static inline void dbg_notify_exec(word addr) {
+}
+static inline void dbg_notify_write(word addr, byte val) {
+}
+static inline void dbg_notify_read(word addr) {
+}
+
+#else
+
 bool dbg_should_break();
 void dbg_cli();
 void dbg_break();
@@ -34,3 +59,5 @@ void dbg_notify_write(word addr, byte val);
 void dbg_notify_read(word addr);
 
 #endif
+
+#endif
@@ -15,6 +15,13 @@
 #define cycle int64_t
 #define sbyte int8_t
 
+// ------
+// Timing
+// ------
+
+#define CYCLES_PER_SECOND 4194304
+#define CYCLES_PER_FRAME 70224
+
 // ----------------
 // Memory Locations
 // ----------------
@@ -26,6 +33,8 @@
 #define OAMSTART 0xFE00
 #define OAMEND 0xFEA0
 #define JOYP 0xFF00
+#define SB 0xFF01
+#define SC 0xFF02
 #define DIV 0xFF04
 #define TIMA 0xFF05
 #define TMA 0xFF06
@@ -0,0 +1,253 @@
+#include "gb.h"
+#include "cpu.h"
+#include "debugger.h"
+#include "input.h"
+#include "lcd.h"
+#include "memory.h"
+#include "opstats.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "timing.h"
+#include "trace.h"
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define PROFILE_FILE "dangerboy.folded"
+#define TIMING_FILE "dangerboy-timing.csv"
+
+// Any padding the compiler slips into a snapshot would change the
+// save state format, so the sizes are pinned down here
+_Static_assert(sizeof(cpu_snapshot) == 40, "cpu_snapshot layout changed");
+_Static_assert(sizeof(lcd_snapshot) == 40, "lcd_snapshot layout changed");
+_Static_assert(sizeof(mem_snapshot) == 0x18068, "mem_snapshot changed");
+_Static_assert(sizeof(gb_state) == 0x180D0, "gb_state layout changed");
+
+// ------------------
+// Internal variables
+// ------------------
+
+_Thread_local cycle frame_start;
+
+// The state right after power on, which gb_reset goes back to
+_Thread_local gb_state* boot_state;
+
+// ------------------
+// Internal functions
+// ------------------
+
+void power_on();
+
+// --------------------
+// Function definitions
+// --------------------
+
+void gb_init(char* fname) {
+   mem_init();
+   mem_load_image(fname);
+   power_on();
+}
+
+// Like gb_init, with the ROM already in memory. Instead of exiting
+// on a bad ROM, returns false. Calling it again reuses the memory
+// the last Game Boy on this thread had.
+bool gb_init_rom(const byte* data, size_t size) {
+   mem_init();
+   if (!mem_load_rom(data, size)) {
+      return false;
+   }
+   power_on();
+   return true;
+}
+
+// Resets everything but memory, which must already hold the ROM
+void power_on() {
+   dbg_init();
+   // The LCD goes first, so the registers cpu_init writes don't see
+   // whatever state a previous Game Boy on this thread left it in
+   lcd_reset();
+   cpu_init();
+   input_reset();
+#ifdef HOST_TIMING
+   timing_reset();
+#endif
+   frame_start = cpu_ticks;
+   rewind_clear();
+   if (boot_state == NULL) {
+      boot_state = malloc(sizeof(gb_state));
+   }
+   gb_save_state(boot_state);
+}
+
+// Powers the Game Boy back on with the ROM already loaded. Rather
+// than setting everything up again, this copies back the state saved
+// at power on, so it costs little more than a memcpy. Breakpoints
+// and frame skip settings are kept, and queued input is dropped.
+void gb_reset() {
+   gb_load_state(boot_state);
+   input_reset();
+}
+
+void gb_free() {
+   trace_stop();
+   opstats_print(stderr);
+#ifdef GUEST_PROFILE
+   profiler_print_flat(stderr, 20);
+   FILE* folded = fopen(PROFILE_FILE, "w");
+   if (folded != NULL) {
+      profiler_write_folded(folded);
+      fclose(folded);
+      fprintf(stderr, "Call stacks written to %s\n", PROFILE_FILE);
+   }
+   profiler_free();
+#endif
+#ifdef HOST_TIMING
+   timing_report(stderr);
+   FILE* csv = fopen(TIMING_FILE, "w");
+   if (csv != NULL) {
+      timing_write_csv(csv);
+      fclose(csv);
+      fprintf(stderr, "Frame times written to %s\n", TIMING_FILE);
+   }
+   timing_free();
+#endif
+   rewind_free();
+   runahead_free();
+   input_free();
+   lcd_free();
+   dbg_free();
+   mem_free();
+   free(boot_state);
+   boot_state = NULL;
+}
+
+// Executes one instruction, stopping in the debugger first if
+// it asked to break.
+void gb_step() {
+   if (dbg_should_break()) {
+      dbg_cli();
+   }
+   cpu_execute_step();
+}
+
+// True once the LCD finishes a frame. While the LCD is off, a frame
+// ends every 70224 cycles instead, so callers still get regular
+// frames. Resets the LCD's ready flag, like lcd_ready.
+bool gb_frame_done() {
+   if (lcd_ready()
+         || (lcd_disabled()
+               && cpu_ticks - frame_start >= CYCLES_PER_FRAME / 4)) {
+      frame_start = cpu_ticks;
+      TIMING_FRAME();
+      return true;
+   }
+   return false;
+}
+
+void gb_run_frame() {
+   while (!gb_frame_done()) {
+      gb_step();
+   }
+}
+
+// Writes straight into s, so it takes microseconds and allocates
+// nothing
+void gb_save_state(gb_state* s) {
+   s->magic   = GB_STATE_MAGIC;
+   s->version = GB_STATE_VERSION;
+   s->size    = sizeof(gb_state);
+   cpu_save_state(&s->cpu);
+   lcd_save_state(&s->lcd);
+   s->frame_start = frame_start;
+   mem_save_state(&s->mem);
+}
+
+// Everything but memory is small enough to copy whole every time
+uint32_t gb_update_state(gb_state* s, uint32_t since, bool* changed) {
+   s->magic   = GB_STATE_MAGIC;
+   s->version = GB_STATE_VERSION;
+   s->size    = sizeof(gb_state);
+   cpu_save_state(&s->cpu);
+   lcd_save_state(&s->lcd);
+   s->frame_start = frame_start;
+   return mem_update_state(&s->mem, since, changed);
+}
+
+// Returns false, changing nothing, if the state is from another
+// version or another ROM
+bool gb_load_state(const gb_state* s) {
+   if (s->magic != GB_STATE_MAGIC || s->version != GB_STATE_VERSION
+         || s->size != sizeof(gb_state)) {
+      return false;
+   }
+   if (!mem_load_state(&s->mem)) {
+      return false;
+   }
+   cycle before = cpu_ticks;
+   cpu_load_state(&s->cpu);
+   lcd_load_state(&s->lcd);
+   frame_start = s->frame_start;
+   // Queued input is stamped with cycles from before the load
+   input_rebase(before, cpu_ticks);
+   return true;
+}
+
+// Like gb_load_state, for stepping back a moment. s must be a state
+// gb_update_state returned since for on this thread, which rules out
+// another version or ROM.
+void gb_restore_state(const gb_state* s, uint32_t since) {
+   mem_restore_state(&s->mem, since);
+   cpu_load_state(&s->cpu);
+   lcd_load_state(&s->lcd);
+   frame_start = s->frame_start;
+   // Input was held while running ahead, so nothing queued was
+   // stamped with the cycles being undone
+   input_due = cpu_ticks;
+}
+
+bool gb_save_state_file(const char* path) {
+   gb_state* s = malloc(sizeof(gb_state));
+   gb_save_state(s);
+   FILE* f    = fopen(path, "wb");
+   bool saved = f != NULL && fwrite(s, sizeof(gb_state), 1, f) == 1;
+   if (f != NULL && fclose(f) != 0) {
+      saved = false;
+   }
+   free(s);
+   if (!saved) {
+      fprintf(stderr, "Couldn't write save state %s\n", path);
+   }
+   return saved;
+}
+
+bool gb_load_state_file(const char* path) {
+   gb_state* s = malloc(sizeof(gb_state));
+   FILE* f     = fopen(path, "rb");
+   bool read   = f != NULL && fread(s, sizeof(gb_state), 1, f) == 1;
+   bool loaded = read && gb_load_state(s);
+   if (f != NULL) {
+      fclose(f);
+   }
+   free(s);
+   if (!read) {
+      fprintf(stderr, "Couldn't read save state %s\n", path);
+   } else if (!loaded) {
+      fprintf(stderr, "%s is from another version or ROM\n", path);
+   }
+   return loaded;
+}
+
+// The calling thread's Game Boy
+gb_t gb_self() {
+   gb_t gb = {input_get_queue(), lcd_get_shared()};
+   return gb;
+}
+
+// Lets the calling thread push input to and read frames from a
+// Game Boy running on another thread
+void gb_select(gb_t gb) {
+   input_select(gb.input);
+   lcd_select(gb.lcd);
+}
@@ -0,0 +1,63 @@
+#ifndef __GB_H__
+#define __GB_H__
+
+#include "cpu.h"
+#include "defines.h"
+#include "input.h"
+#include "lcd.h"
+
+// Ties the CPU, memory and LCD together, so frontends don't
+// need to know the order everything is set up and stepped in.
+//
+// All emulator state is thread local, so every thread can run its
+// own Game Boy, set up with gb_init on that thread. The profiling
+// and tracing options and the debugger are still process wide, so
+// only use them with a single Game Boy running.
+
+// The parts of a Game Boy that other threads may use
+typedef struct gb_t_ {
+   input_queue* input;
+   lcd_shared* lcd;
+} gb_t;
+
+// Save states start with these, in host byte order. A state only
+// loads into the same version, so any change to the layout of the
+// snapshots below must bump GB_STATE_VERSION.
+#define GB_STATE_MAGIC 0x53534244 // "DBSS"
+#define GB_STATE_VERSION 2
+
+// A whole Game Boy, minus the ROM and whatever the frontend owns:
+// input still queued, frame skip settings and the framebuffers.
+// Every field has a fixed size and place, so a state can be written
+// out as is. Only valid on a thread running the same ROM.
+typedef struct gb_state_ {
+   uint32_t magic;
+   uint32_t version;
+   uint64_t size; // sizeof(gb_state)
+   cpu_snapshot cpu;
+   lcd_snapshot lcd;
+   int64_t frame_start;
+   mem_snapshot mem;
+} gb_state;
+
+void gb_init(char* fname);
+bool gb_init_rom(const byte* data, size_t size);
+void gb_reset();
+void gb_free();
+void gb_step();
+bool gb_frame_done();
+void gb_run_frame();
+void gb_save_state(gb_state* s);
+bool gb_load_state(const gb_state* s);
+// Like gb_save_state, but only copies the memory written since the
+// call that returned since, which s must still hold. Taking a state
+// each frame this way copies a few pages rather than 96KB. Pass 0 the
+// first time. changed is as for mem_update_state.
+uint32_t gb_update_state(gb_state* s, uint32_t since, bool* changed);
+void gb_restore_state(const gb_state* s, uint32_t since);
+bool gb_save_state_file(const char* path);
+bool gb_load_state_file(const char* path);
+gb_t gb_self();
+void gb_select(gb_t gb);
+
+#endif
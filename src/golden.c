@@ -0,0 +1,211 @@
+#include "golden.h"
+#include "gb.h"
+#include "lcd.h"
+
+#include <string.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define FB_W 160
+#define FB_H 144
+#define PATH_LEN 1024
+
+// ------------------
+// Internal functions
+// ------------------
+
+void golden_name(const char* rom, char* name, int len);
+int read_golden(const char* path, int* frames, uint32_t* hashes);
+bool write_pgm(const char* path, const byte* fb);
+bool read_pgm(const char* path, byte* fb);
+bool write_diff(const char* path, const byte* expected, const byte* actual);
+
+// --------------------
+// Function definitions
+// --------------------
+
+// FNV-1a over the greyscale framebuffer
+uint32_t golden_hash(const byte* fb) {
+   uint32_t h = 2166136261u;
+   for (int i = 0; i < FB_W * FB_H; ++i) {
+      h = (h ^ fb[i]) * 16777619u;
+   }
+   return h;
+}
+
+// The ROM's file name without its directory or extension
+void golden_name(const char* rom, char* name, int len) {
+   const char* base = strrchr(rom, '/');
+   base             = base ? base + 1 : rom;
+   snprintf(name, len, "%s", base);
+   char* ext = strrchr(name, '.');
+   if (ext != NULL && ext != name) {
+      *ext = '\0';
+   }
+}
+
+int read_golden(const char* path, int* frames, uint32_t* hashes) {
+   FILE* f = fopen(path, "r");
+   if (f == NULL) {
+      return 0;
+   }
+   int count = 0;
+   while (count < GOLDEN_MAX_FRAMES
+         && fscanf(f, "%d %" SCNx32, &frames[count], &hashes[count]) == 2) {
+      count++;
+   }
+   fclose(f);
+   return count;
+}
+
+bool write_pgm(const char* path, const byte* fb) {
+   FILE* f = fopen(path, "wb");
+   if (f == NULL) {
+      fprintf(stderr, "Couldn't write %s\n", path);
+      return false;
+   }
+   fprintf(f, "P5\n%d %d\n255\n", FB_W, FB_H);
+   fwrite(fb, 1, FB_W * FB_H, f);
+   fclose(f);
+   return true;
+}
+
+// Only reads the PGMs write_pgm makes
+bool read_pgm(const char* path, byte* fb) {
+   FILE* f = fopen(path, "rb");
+   if (f == NULL) {
+      return false;
+   }
+   int w = 0, h = 0, max = 0;
+   bool ok = fscanf(f, "P5 %d %d %d", &w, &h, &max) == 3 && w == FB_W
+         && h == FB_H && fgetc(f) != EOF
+         && fread(fb, 1, FB_W * FB_H, f) == FB_W * FB_H;
+   fclose(f);
+   return ok;
+}
+
+// Matching pixels are dimmed, mismatched ones are red
+bool write_diff(const char* path, const byte* expected, const byte* actual) {
+   FILE* f = fopen(path, "wb");
+   if (f == NULL) {
+      fprintf(stderr, "Couldn't write %s\n", path);
+      return false;
+   }
+   fprintf(f, "P6\n%d %d\n255\n", FB_W, FB_H);
+   for (int i = 0; i < FB_W * FB_H; ++i) {
+      byte rgb[3];
+      if (expected[i] == actual[i]) {
+         rgb[0] = rgb[1] = rgb[2] = 64 + expected[i] / 4;
+      } else {
+         rgb[0] = 255;
+         rgb[1] = rgb[2] = 0;
+      }
+      fwrite(rgb, 1, 3, f);
+   }
+   fclose(f);
+   return true;
+}
+
+int golden_check(const char* rom,
+      const int* frames,
+      int count,
+      const char* dir,
+      bool update) {
+   char name[256];
+   char path[PATH_LEN];
+   golden_name(rom, name, sizeof(name));
+
+   int golden_frames[GOLDEN_MAX_FRAMES];
+   uint32_t golden_hashes[GOLDEN_MAX_FRAMES];
+   int golden_count = 0;
+   if (!update) {
+      snprintf(path, PATH_LEN, "%s/%s.txt", dir, name);
+      golden_count = read_golden(path, golden_frames, golden_hashes);
+      if (golden_count == 0) {
+         fprintf(stderr, "No golden hashes in %s\n", path);
+         return count;
+      }
+   }
+
+   int last = 0;
+   for (int i = 0; i < count; ++i) {
+      last = frames[i] > last ? frames[i] : last;
+   }
+
+   // Only draw the frames being checked. Each gb_run_frame starts
+   // the next frame, which is when a request takes effect.
+   lcd_set_frame_skip(LCD_RENDER_ON_DEMAND);
+   uint32_t hashes[GOLDEN_MAX_FRAMES];
+   int mismatches = 0;
+   for (int frame = 0; frame <= last; ++frame) {
+      for (int i = 0; i < count; ++i) {
+         if (frames[i] == frame) {
+            lcd_request_frame();
+         }
+      }
+      gb_run_frame();
+
+      for (int i = 0; i < count; ++i) {
+         if (frames[i] != frame) {
+            continue;
+         }
+         byte* fb  = lcd_get_framebuffer();
+         hashes[i] = golden_hash(fb);
+         if (update) {
+            snprintf(path, PATH_LEN, "%s/%s-%d.pgm", dir, name, frame);
+            write_pgm(path, fb);
+            continue;
+         }
+
+         int g = 0;
+         while (g < golden_count && golden_frames[g] != frame) {
+            g++;
+         }
+         if (g == golden_count) {
+            printf("MISSING   %s frame %d: no golden hash\n", name, frame);
+            mismatches++;
+            continue;
+         }
+         if (golden_hashes[g] == hashes[i]) {
+            printf("OK        %s frame %d: %08" PRIX32 "\n",
+                  name,
+                  frame,
+                  hashes[i]);
+            continue;
+         }
+
+         printf("MISMATCH  %s frame %d: expected %08" PRIX32
+                ", got %08" PRIX32 "\n",
+               name,
+               frame,
+               golden_hashes[g],
+               hashes[i]);
+         mismatches++;
+         snprintf(path, PATH_LEN, "%s/%s-%d-actual.pgm", dir, name, frame);
+         write_pgm(path, fb);
+         byte expected[FB_W * FB_H];
+         snprintf(path, PATH_LEN, "%s/%s-%d.pgm", dir, name, frame);
+         if (read_pgm(path, expected)) {
+            snprintf(path, PATH_LEN, "%s/%s-%d-diff.ppm", dir, name, frame);
+            write_diff(path, expected, fb);
+         }
+      }
+   }
+
+   if (update) {
+      snprintf(path, PATH_LEN, "%s/%s.txt", dir, name);
+      FILE* f = fopen(path, "w");
+      if (f == NULL) {
+         fprintf(stderr, "Couldn't write %s\n", path);
+         return count;
+      }
+      for (int i = 0; i < count; ++i) {
+         fprintf(f, "%d %08" PRIX32 "\n", frames[i], hashes[i]);
+      }
+      fclose(f);
+      printf("Saved %d golden frames for %s to %s\n", count, name, dir);
+   }
+   return mismatches;
+}
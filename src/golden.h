@@ -0,0 +1,24 @@
+#ifndef __GOLDEN_H__
+#define __GOLDEN_H__
+
+#include "defines.h"
+
+// Checks rendered frames against hashes saved from a known good
+// build. Each ROM gets <dir>/<rom name>.txt with one "frame hash"
+// pair per line, plus a PGM of every frame for making diffs.
+
+#define GOLDEN_MAX_FRAMES 64
+
+// Runs the loaded ROM through the last of the given frames. With
+// update set, saves what was drawn as the new golden frames.
+// Otherwise writes <name>-<frame>-actual.pgm and a -diff.ppm for
+// each mismatch. Returns the number of mismatched frames.
+int golden_check(const char* rom,
+      const int* frames,
+      int count,
+      const char* dir,
+      bool update);
+
+uint32_t golden_hash(const byte* fb);
+
+#endif
@@ -0,0 +1,298 @@
+#include "headless.h"
+#include "batch.h"
+#include "bench.h"
+#include "cpu.h"
+#include "gb.h"
+#include "golden.h"
+#include "lcd.h"
+#include "memory.h"
+#include "runahead.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define DEFAULT_FRAMES 600 // 10 seconds of emulated time
+
+// Exit codes for --test
+#define EXIT_PASSED 0
+#define EXIT_FAILED 1
+#define EXIT_TIMEOUT 2
+
+// ------------------
+// Internal functions
+// ------------------
+
+void headless_usage(const char* name);
+int parse_frame_list(const char* list, int* frames);
+
+// --------------------
+// Function definitions
+// --------------------
+
+void headless_usage(const char* name) {
+   printf("USAGE: %s <binary> [ --frames N ] [ --until-pc HEX ] [ -v ]\n"
+          "          [ --load-state FILE ] [ --save-state FILE ]\n",
+         name);
+   printf("       %s <binary> --test [ --frames N ]\n", name);
+   printf("       %s <binary> --golden DIR --hash-frames N,N,... "
+          "[ --update ] [ --threaded ]\n",
+         name);
+   printf("       %s <binary> --bench N [ --render ] [ --present ] "
+          "[ --json ]\n"
+          "          [ --run-ahead N ]\n",
+         name);
+   printf("       %s --batch JOBS [ --out FILE ] [ --threads N ] "
+          "[ --dump-ram DIR ]\n",
+         name);
+   printf("Any mode but --batch also takes --trace FILE\n");
+}
+
+// Reads a comma separated list of frame numbers
+int parse_frame_list(const char* list, int* frames) {
+   int count = 0;
+   char* end = NULL;
+   while (count < GOLDEN_MAX_FRAMES) {
+      long f = strtol(list, &end, 10);
+      if (end == list || f < 0) {
+         return 0;
+      }
+      frames[count++] = f;
+      if (*end != ',') {
+         break;
+      }
+      list = end + 1;
+   }
+   return *end == '\0' ? count : 0;
+}
+
+int headless_main(int argc, char* args[]) {
+   char* file   = NULL;
+   int frames   = DEFAULT_FRAMES;
+   int until_pc = -1;
+   bool verbose = false;
+   int bench    = 0;
+   bool render  = false;
+   bool present = false;
+   bool json    = false;
+   bool test    = false;
+   char* golden = NULL;
+   bool update  = false;
+   bool thread  = false;
+   char* trace  = NULL;
+   char* batch  = NULL;
+   char* out    = NULL;
+   char* dump   = NULL;
+   int threads  = 0;
+   char* load   = NULL;
+   char* save   = NULL;
+   int ahead    = 0;
+   char* single = NULL; // An option only a single ROM run takes
+
+   int hash_frames[GOLDEN_MAX_FRAMES];
+   int hash_count = 0;
+   for (int a = 1; a < argc; ++a) {
+      if (strcmp(args[a], "--headless") == 0) {
+         continue;
+      }
+      if (strcmp(args[a], "--frames") == 0 && a + 1 < argc) {
+         single = args[a];
+         frames = atoi(args[++a]);
+      } else if (strcmp(args[a], "--until-pc") == 0 && a + 1 < argc) {
+         single   = args[a];
+         until_pc = strtol(args[++a], NULL, 16) & 0xFFFF;
+      } else if (strcmp(args[a], "-v") == 0) {
+         single  = args[a];
+         verbose = true;
+      } else if (strcmp(args[a], "--bench") == 0 && a + 1 < argc) {
+         single = args[a];
+         bench  = atoi(args[++a]);
+         if (bench < 1) {
+            fprintf(stderr, "Bench needs at least one frame\n");
+            return 1;
+         }
+      } else if (strcmp(args[a], "--render") == 0) {
+         render = true;
+      } else if (strcmp(args[a], "--run-ahead") == 0 && a + 1 < argc) {
+         single = args[a];
+         ahead  = atoi(args[++a]);
+      } else if (strcmp(args[a], "--present") == 0) {
+         present = true;
+      } else if (strcmp(args[a], "--json") == 0) {
+         json = true;
+      } else if (strcmp(args[a], "--test") == 0) {
+         single = args[a];
+         test   = true;
+      } else if (strcmp(args[a], "--golden") == 0 && a + 1 < argc) {
+         single = args[a];
+         golden = args[++a];
+      } else if (strcmp(args[a], "--hash-frames") == 0 && a + 1 < argc) {
+         hash_count = parse_frame_list(args[++a], hash_frames);
+         if (hash_count == 0) {
+            fprintf(stderr, "Bad frame list %s\n", args[a]);
+            return 1;
+         }
+      } else if (strcmp(args[a], "--update") == 0) {
+         update = true;
+      } else if (strcmp(args[a], "--threaded") == 0) {
+         thread = true;
+      } else if (strcmp(args[a], "--trace") == 0 && a + 1 < argc) {
+         single = args[a];
+         trace  = args[++a];
+      } else if (strcmp(args[a], "--batch") == 0 && a + 1 < argc) {
+         batch = args[++a];
+      } else if (strcmp(args[a], "--out") == 0 && a + 1 < argc) {
+         out = args[++a];
+      } else if (strcmp(args[a], "--threads") == 0 && a + 1 < argc) {
+         threads = atoi(args[++a]);
+      } else if (strcmp(args[a], "--dump-ram") == 0 && a + 1 < argc) {
+         dump = args[++a];
+      } else if (strcmp(args[a], "--load-state") == 0 && a + 1 < argc) {
+         single = args[a];
+         load   = args[++a];
+      } else if (strcmp(args[a], "--save-state") == 0 && a + 1 < argc) {
+         single = args[a];
+         save   = args[++a];
+      } else if (args[a][0] == '-') {
+         fprintf(stderr, "Unknown option %s\n", args[a]);
+         headless_usage(args[0]);
+         return 1;
+      } else {
+         file   = args[a];
+         single = args[a];
+      }
+   }
+   if (ahead != 0 && bench == 0) {
+      fprintf(stderr, "--run-ahead needs --bench\n");
+      return 1;
+   }
+   // Batch jobs each name their own ROM
+   if (batch != NULL) {
+      if (single != NULL) {
+         fprintf(stderr, "--batch doesn't take %s\n", single);
+         return 1;
+      }
+      FILE* results = out != NULL ? fopen(out, "w") : stdout;
+      if (results == NULL) {
+         fprintf(stderr, "Couldn't open %s\n", out);
+         return 1;
+      }
+      int failed = batch_run(batch, results, threads, dump);
+      if (results != stdout) {
+         fclose(results);
+      }
+      return failed > 0;
+   }
+
+   if (file == NULL || frames < 1) {
+      headless_usage(args[0]);
+      return 1;
+   }
+
+   gb_init(file);
+   lcd_set_threaded(thread);
+   if (trace != NULL && !trace_start(trace)) {
+      gb_free();
+      return 1;
+   }
+
+   if (golden != NULL) {
+      if (hash_count == 0) {
+         fprintf(stderr, "--golden needs --hash-frames\n");
+         gb_free();
+         return 1;
+      }
+      int mismatches =
+            golden_check(file, hash_frames, hash_count, golden, update);
+      gb_free();
+      return mismatches > 0;
+   }
+
+   if (bench > 0) {
+      runahead_init(ahead);
+      bench_result r = bench_run(bench, render, present);
+      if (json) {
+         bench_print_json(stdout, file, &r);
+      } else {
+         bench_print(stdout, file, &r);
+         runahead_report(stdout);
+      }
+      gb_free();
+      return 0;
+   }
+
+   // Nothing is shown, so only the frames we hash get drawn.
+   // Stopping on a PC can happen in any frame, so that draws them all.
+   lcd_set_frame_skip(until_pc < 0 ? LCD_RENDER_ON_DEMAND : 0);
+   if (load != NULL && !gb_load_state_file(load)) {
+      gb_free();
+      return 1;
+   }
+
+   int frame    = 0;
+   bool stopped = false;
+   for (frame = 0; frame < frames && !stopped; ++frame) {
+      if (frame == frames - 1) {
+         lcd_request_frame();
+      }
+      while (!gb_frame_done()) {
+         gb_step();
+         if (cpu_get_state().pc == until_pc) {
+            stopped = true;
+            break;
+         }
+         if (test && cpu_test_result != TEST_RUNNING) {
+            stopped = true;
+            break;
+         }
+      }
+      if (verbose) {
+         printf("Frame %d at cycle %lld\n", frame, (long long)cpu_ticks);
+      }
+   }
+
+   if (save != NULL && !gb_save_state_file(save)) {
+      gb_free();
+      return 1;
+   }
+
+   // One line per ROM, so results from parallel runs stay readable
+   if (test) {
+      int code = EXIT_TIMEOUT;
+      if (cpu_test_result == TEST_PASSED) {
+         printf("PASS     %s (%d frames)\n", file, frame);
+         code = EXIT_PASSED;
+      } else if (cpu_test_result == TEST_FAILED) {
+         printf("FAIL     %s (%d frames)\n", file, frame);
+         code = EXIT_FAILED;
+      } else {
+         printf("TIMEOUT  %s (%d frames)\n", file, frame);
+      }
+      gb_free();
+      return code;
+   }
+
+   cpu_state cpu = cpu_get_state();
+   printf("%s\n", file);
+   printf("Frames: %d\n", frame);
+   printf("Cycles: %lld\n", (long long)cpu_ticks * 4);
+   printf("PC: %04X%s\n", cpu.pc, stopped ? " (stopped)" : "");
+   printf("AF: %02X%X0 BC: %02X%02X DE: %02X%02X HL: %02X%02X SP: %04X\n",
+         cpu.a,
+         cpu.zf << 3 | cpu.nf << 2 | cpu.hf << 1 | cpu.cf,
+         cpu.b,
+         cpu.c,
+         cpu.d,
+         cpu.e,
+         cpu.h,
+         cpu.l,
+         cpu.sp);
+   printf("Frame hash: %08X\n", golden_hash(lcd_get_framebuffer()));
+
+   gb_free();
+   return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __HEADLESS_H__
+#define __HEADLESS_H__
+
+// Runs a ROM with no video, input or debugger, then exits.
+// Takes the same arguments as main.
+int headless_main(int argc, char* args[]);
+
+#endif
@@ -0,0 +1,7 @@
+#include "headless.h"
+
+// Entry point for the dangerboy-headless build, which links
+// neither SDL nor ncurses.
+int main(int argc, char* args[]) {
+   return headless_main(argc, args);
+}
@@ -0,0 +1,177 @@
+#include "input.h"
+
+#include <stdatomic.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define QUEUE_SIZE 256 // Must be a power of two
+#define TICKS_PER_SECOND (CYCLES_PER_SECOND / 4)
+#define NS_PER_SECOND 1000000000LL
+
+// How often to look for new events when the queue is empty
+#define POLL_TICKS 64
+
+// Marks an event stamped with host time that hasn't been
+// converted to a cycle yet
+#define HOST_TIME -1
+
+typedef struct input_event_ {
+   cycle at;
+   int64_t ns;
+   input_kind kind;
+   byte mask;
+   bool pressed;
+} input_event;
+
+// Single producer, single consumer ring. The producer only writes
+// head, the consumer only writes tail.
+struct input_queue_ {
+   input_event events[QUEUE_SIZE];
+   atomic_uint head;
+   atomic_uint tail;
+};
+
+// ------------------
+// Internal variables
+// ------------------
+
+// This Game Boy's queue. A producer on another thread points its
+// own copy at the same queue with input_select.
+_Thread_local input_queue* queue;
+
+_Thread_local cycle input_due;
+
+// Host time that corresponds to clock_ticks, for converting
+// host stamped events. Only touched by the emulation thread.
+_Thread_local int64_t clock_ns;
+_Thread_local cycle clock_ticks;
+_Thread_local bool clock_set;
+
+// ------------------
+// Internal functions
+// ------------------
+
+bool push_event(input_event* e);
+void apply_event(input_event* e);
+
+// --------------------
+// Function definitions
+// --------------------
+
+void input_reset() {
+   if (queue == NULL) {
+      queue = malloc(sizeof(input_queue));
+   }
+   atomic_store(&queue->head, 0);
+   atomic_store(&queue->tail, 0);
+   input_due = 0;
+   clock_set = false;
+}
+
+void input_free() {
+   free(queue);
+   queue = NULL;
+}
+
+input_queue* input_get_queue() {
+   return queue;
+}
+
+// Lets the calling thread push events to another thread's Game Boy
+void input_select(input_queue* q) {
+   queue = q;
+}
+
+bool push_event(input_event* e) {
+   unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+   unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+   if (head - tail >= QUEUE_SIZE) {
+      return false; // Full, drop the event
+   }
+   queue->events[head % QUEUE_SIZE] = *e;
+   atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+   return true;
+}
+
+// Queues an event for the given cycle. Events must be pushed in
+// order, and ones in the past are applied on the next step.
+bool input_push(cycle at, input_kind kind, byte mask, bool pressed) {
+   input_event e = {at, 0, kind, mask, pressed};
+   return push_event(&e);
+}
+
+// Queues an event stamped with host time, in nanoseconds on the
+// same clock passed to input_sync_clock.
+bool input_push_host(int64_t ns, input_kind kind, byte mask, bool pressed) {
+   input_event e = {HOST_TIME, ns, kind, mask, pressed};
+   return push_event(&e);
+}
+
+// Records that host time ns corresponds to cycle now. Call from the
+// emulation thread whenever the two are known to line up, such as
+// right after pacing_wait.
+void input_sync_clock(int64_t ns, cycle now) {
+   clock_ns    = ns;
+   clock_ticks = now;
+   clock_set   = true;
+}
+
+void apply_event(input_event* e) {
+   if (e->kind == INPUT_BUTTON) {
+      if (e->pressed) {
+         press_button(e->mask);
+      } else {
+         release_button(e->mask);
+      }
+   } else {
+      if (e->pressed) {
+         press_dpad(e->mask);
+      } else {
+         release_dpad(e->mask);
+      }
+   }
+}
+
+// Moves the cycle clock from one count to another, like a save state
+// loading does. Events already stamped in cycles, and the host time
+// sync, move with it, so queued input is as far off as it was.
+void input_rebase(cycle from, cycle to) {
+   cycle delta   = to - from;
+   unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+   unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+   for (; tail != head; ++tail) {
+      input_event* e = &queue->events[tail % QUEUE_SIZE];
+      if (e->at != HOST_TIME) {
+         e->at += delta;
+      }
+   }
+   clock_ticks += delta;
+   input_due = to;
+}
+
+// Applies every queued event that is due at cycle now
+void input_update(cycle now) {
+   unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+   unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+   while (tail != head) {
+      input_event* e = &queue->events[tail % QUEUE_SIZE];
+      if (e->at == HOST_TIME) {
+         e->at = now;
+         if (clock_set && e->ns > clock_ns) {
+            e->at = clock_ticks
+                    + (e->ns - clock_ns) * TICKS_PER_SECOND / NS_PER_SECOND;
+         }
+      }
+      if (e->at > now) {
+         input_due = e->at;
+         atomic_store_explicit(&queue->tail, tail, memory_order_release);
+         return;
+      }
+      apply_event(e);
+      tail++;
+   }
+   atomic_store_explicit(&queue->tail, tail, memory_order_release);
+   input_due = now + POLL_TICKS;
+}
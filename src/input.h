@@ -0,0 +1,29 @@
+#ifndef __INPUT_H__
+#define __INPUT_H__
+
+#include "defines.h"
+#include "memory.h"
+
+// Joypad events, queued by one producer thread and applied by the
+// emulation thread at the cycle they are stamped with. Cycles here
+// are machine cycles, the same units as cpu_ticks. A producer on
+// another thread selects the queue it pushes to first.
+
+typedef enum input_kind_ { INPUT_BUTTON, INPUT_DPAD } input_kind;
+typedef struct input_queue_ input_queue;
+
+// The next cycle input_update needs to run. Lets the CPU skip
+// the call on steps where nothing can be due.
+extern _Thread_local cycle input_due;
+
+void input_reset();
+void input_free();
+input_queue* input_get_queue();
+void input_select(input_queue* q);
+bool input_push(cycle at, input_kind kind, byte mask, bool pressed);
+bool input_push_host(int64_t ns, input_kind kind, byte mask, bool pressed);
+void input_sync_clock(int64_t ns, cycle now);
+void input_rebase(cycle from, cycle to);
+void input_update(cycle now);
+
+#endif
@@ -1,5 +1,11 @@
 #include "lcd.h"
 #include "debugger.h"
+#include "timing.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
 
 // ----------------
 // Internal defines
@@ -22,6 +28,15 @@
 // TODO: Make this a runtime option.
 //#define PER_PIXEL
 
+// Triple buffering. Frames are drawn into the back buffer, which is
+// swapped with the middle one when complete. The reader swaps its
+// front buffer with the middle one when the middle is marked fresh.
+#define FB_COUNT 3
+#define FB_FRESH 0x4
+
+#define VRAM_SIZE 0x2000
+#define OAM_SIZE 0xA0
+
 typedef enum lcd_mode_ {
    HBLANK = 0, // Lasts ~200 cycles
    VBLANK = 1, // Lasts ~4560 cycles
@@ -29,44 +44,128 @@ typedef enum lcd_mode_ {
    VRAM   = 3  // Lasts ~172 cycles
 } lcd_mode;
 
+// Everything draw_scanline needs to know about the registers,
+// captured at the end of mode 3 for each line.
+typedef struct line_regs_ {
+   byte lcdc;
+   byte scx, scy;
+   byte wx, wy;
+   byte bgp, obp0, obp1;
+   byte ly;
+   byte win_ly;
+} line_regs;
+
+// A copy of video memory, taken whenever it changed since
+// the previous captured line.
+typedef struct video_copy_ {
+   byte vram[VRAM_SIZE];
+   byte oam[OAM_SIZE];
+} video_copy;
+
+// One frame's worth of captured lines for the render thread
+typedef struct frame_job_ {
+   int line_count;
+   line_regs lines[144];
+   int line_copy[144];
+   int copy_count;
+   uint32_t copy_gen;
+   video_copy* copies;
+   bool publish; // Frame is complete once these lines are drawn
+   uint32_t frame;
+} frame_job;
+
+// Everything the render thread and frame readers share with the
+// emulation thread. Each Game Boy allocates its own.
+struct lcd_shared_ {
+   byte framebuffers[FB_COUNT][160 * 144];
+   uint32_t fb_frame[FB_COUNT]; // Frame number held by each buffer
+   int fb_back;                 // Owned by whoever draws lines
+   int fb_front;                // Owned by the reader
+   atomic_int fb_middle;        // Latest complete frame, and FB_FRESH
+
+   // Optional caller provided output. Each drawn line is also written
+   // here, converted through a lookup table indexed by grey value.
+   byte* out_pixels;
+   int out_pitch;
+   lcd_format out_format;
+   uint32_t out_lut[256];
+
+   // Threaded rendering. The emulation thread fills one job while the
+   // render thread draws the other, so frame N is drawn while frame
+   // N + 1 is emulated.
+   frame_job jobs[2];
+   int job_queued; // Job being drawn by the render thread, or -1
+   bool render_quit;
+   pthread_mutex_t job_lock;
+   pthread_cond_t job_cond;
+};
+
 // ------------------
 // Internal variables
 // ------------------
 
-cycle timer;
-byte win_y;
-byte win_ly;
-byte ly;
-byte x_pixel;
-byte framebuffer[160 * 144];
-bool stat_fired;
-bool disabled;
-bool ready;
+// The render thread and frame readers point their own copy of this
+// at the Game Boy they work for
+_Thread_local lcd_shared* shared;
+_Thread_local cycle timer;
+_Thread_local byte win_y;
+_Thread_local byte win_ly;
+_Thread_local byte ly;
+_Thread_local byte x_pixel;
+_Thread_local uint32_t frame_count;
+_Thread_local bool stat_fired;
+_Thread_local bool disabled;
+_Thread_local bool ready;
+
+// Frame skipping. Skipped frames keep all of their timing and
+// interrupts, only the pixel work in draw_scanline is bypassed.
+_Thread_local int render_skip;
+_Thread_local int skip_count;
+_Thread_local bool render_requested;
+_Thread_local bool render_frame;   // The frame in progress is being drawn
+_Thread_local bool frame_rendered; // The last completed frame was drawn
+
+// Threaded rendering, see lcd_shared for the jobs themselves
+_Thread_local bool threaded;
+_Thread_local int job_fill; // Job being filled by the emulation thread
+_Thread_local pthread_t render_thread;
 
 // These variables combined are the STAT register.
-lcd_mode mode;
-bool stat_vbl_on;
-bool stat_hbl_on;
-bool stat_oam_on;
-bool stat_lyc_on;
+_Thread_local lcd_mode mode;
+const char* mode_names[] = {"HBLANK", "VBLANK", "OAM", "VRAM"};
+_Thread_local bool stat_vbl_on;
+_Thread_local bool stat_hbl_on;
+_Thread_local bool stat_oam_on;
+_Thread_local bool stat_lyc_on;
 
 // These values are used to replicate the behavior found in
 // http://gameboy.mongenel.com/dmg/istat98.txt
 // This doesn't seem to be totally accurate, so this behavior
 // needs to be verified.
-bool vblank_fired;
-int ignore_oams;
+_Thread_local bool vblank_fired;
+_Thread_local int ignore_oams;
 
 // Mooneye tests demonstrate that SCX affects
 // the length of the VRAM and HBLANK modes.
-int scroll_delay;
+_Thread_local int scroll_delay;
 
 // ------------------
 // Internal functions
 // ------------------
 
 void draw_pixel(int x, int y);
-void draw_scanline();
+void draw_scanline(const line_regs* r,
+      const byte* vram,
+      const byte* oam,
+      byte* out);
+void capture_line(line_regs* r);
+void queue_line();
+void submit_frame(bool publish);
+void publish_frame(uint32_t frame);
+void emit_line(const byte* fb, int y);
+void* render_main(void* arg);
+bool window_on_line();
+void start_frame();
 void set_mode(lcd_mode new_mode);
 void calc_timing();
 void try_fire_oam();
@@ -89,8 +188,177 @@ bool lcd_ready() {
    return answer;
 }
 
+// Returns the frame that just finished. Call it from the
+// emulation thread, or use lcd_latest_frame from one other thread.
 byte* lcd_get_framebuffer() {
-   return framebuffer;
+   lcd_sync();
+   return lcd_latest_frame(NULL);
+}
+
+// Returns the most recently completed frame without waiting on
+// the emulator. It isn't written to until the next call, so it can
+// be read while emulation continues. Only one thread may call this,
+// and one other than the emulation thread must gb_select it first.
+byte* lcd_latest_frame(uint32_t* frame) {
+   lcd_shared* s = shared;
+   if (atomic_load(&s->fb_middle) & FB_FRESH) {
+      s->fb_front = atomic_exchange(&s->fb_middle, s->fb_front) & ~FB_FRESH;
+   }
+   if (frame != NULL) {
+      *frame = s->fb_frame[s->fb_front];
+   }
+   return s->framebuffers[s->fb_front];
+}
+
+// Also writes every drawn line to pixels, in the given format, with
+// rows pitch bytes apart. Passing NULL stops this. The buffer is
+// written by the render thread in threaded mode, so only read it
+// after lcd_sync().
+void lcd_set_output(lcd_format format, void* pixels, int pitch) {
+   lcd_sync();
+   shared->out_pixels = pixels;
+   shared->out_pitch  = pitch;
+   shared->out_format = format;
+   uint32_t* lut      = shared->out_lut;
+
+   const byte greys[] = {C_WHITE, C_LITE, C_DARK, C_BLACK};
+   for (int shade = 0; shade < 4; ++shade) {
+      uint32_t g = greys[shade];
+      switch (format) {
+         case LCD_INDEX8:
+            lut[g] = shade;
+            break;
+         case LCD_GREY8:
+            lut[g] = g;
+            break;
+         case LCD_RGB565:
+            lut[g] = ((g >> 3) << 11) | ((g >> 2) << 5) | (g >> 3);
+            break;
+         case LCD_XRGB8888:
+            lut[g] = 0xFF000000 | (g << 16) | (g << 8) | g;
+            break;
+      }
+   }
+}
+
+// Converts line y of a framebuffer into the caller's output
+void emit_line(const byte* fb, int y) {
+   if (shared->out_pixels == NULL) {
+      return;
+   }
+   const uint32_t* lut = shared->out_lut;
+   const byte* src     = fb + y * 160;
+   byte* dst           = shared->out_pixels + y * shared->out_pitch;
+   switch (shared->out_format) {
+      case LCD_INDEX8:
+      case LCD_GREY8:
+         for (int x = 0; x < 160; ++x) {
+            dst[x] = lut[src[x]];
+         }
+         break;
+      case LCD_RGB565:
+         for (int x = 0; x < 160; ++x) {
+            ((uint16_t*)dst)[x] = lut[src[x]];
+         }
+         break;
+      case LCD_XRGB8888:
+         for (int x = 0; x < 160; ++x) {
+            ((uint32_t*)dst)[x] = lut[src[x]];
+         }
+         break;
+   }
+}
+
+// Hands the back buffer over as the latest complete frame
+void publish_frame(uint32_t frame) {
+   lcd_shared* s           = shared;
+   s->fb_frame[s->fb_back] = frame;
+   s->fb_back =
+         atomic_exchange(&s->fb_middle, s->fb_back | FB_FRESH) & ~FB_FRESH;
+}
+
+// Moves line drawing to a second thread. The framebuffer
+// is then only up to date after lcd_sync().
+void lcd_set_threaded(bool on) {
+#ifndef PER_PIXEL
+   if (on == threaded) {
+      return;
+   }
+   if (on) {
+      for (int j = 0; j < 2; ++j) {
+         shared->jobs[j].line_count = 0;
+         shared->jobs[j].copy_count = 0;
+         shared->jobs[j].copies     = calloc(144, sizeof(video_copy));
+      }
+      job_fill            = 0;
+      shared->job_queued  = -1;
+      shared->render_quit = false;
+      pthread_mutex_init(&shared->job_lock, NULL);
+      pthread_cond_init(&shared->job_cond, NULL);
+      pthread_create(&render_thread, NULL, render_main, shared);
+      threaded = true;
+   } else {
+      submit_frame(false);
+      pthread_mutex_lock(&shared->job_lock);
+      shared->render_quit = true;
+      pthread_cond_broadcast(&shared->job_cond);
+      pthread_mutex_unlock(&shared->job_lock);
+      pthread_join(render_thread, NULL);
+      pthread_cond_destroy(&shared->job_cond);
+      pthread_mutex_destroy(&shared->job_lock);
+      for (int j = 0; j < 2; ++j) {
+         free(shared->jobs[j].copies);
+         shared->jobs[j].copies = NULL;
+      }
+      threaded = false;
+   }
+#endif
+}
+
+// Waits until the render thread has drawn every submitted line
+void lcd_sync() {
+   if (!threaded) {
+      return;
+   }
+   submit_frame(false);
+   pthread_mutex_lock(&shared->job_lock);
+   while (shared->job_queued != -1) {
+      pthread_cond_wait(&shared->job_cond, &shared->job_lock);
+   }
+   pthread_mutex_unlock(&shared->job_lock);
+}
+
+void lcd_free() {
+   lcd_set_threaded(false);
+   free(shared);
+   shared = NULL;
+}
+
+lcd_shared* lcd_get_shared() {
+   return shared;
+}
+
+// Lets the calling thread read another thread's frames
+void lcd_select(lcd_shared* s) {
+   shared = s;
+}
+
+// Draw one out of every skip + 1 frames. LCD_RENDER_ON_DEMAND
+// only draws frames asked for with lcd_request_frame().
+// Takes effect at the start of the next frame.
+void lcd_set_frame_skip(int skip) {
+   render_skip = skip;
+   skip_count  = 0;
+}
+
+// Draw the next frame when in LCD_RENDER_ON_DEMAND mode
+void lcd_request_frame() {
+   render_requested = true;
+}
+
+// True if the framebuffer was updated by the last completed frame
+bool lcd_frame_rendered() {
+   return frame_rendered;
 }
 
 // Exposes the internal timer for debugging
@@ -139,13 +407,35 @@ bool fire_stat() {
    return false;
 }
 
+// Decides if the frame that is starting gets drawn
+void start_frame() {
+   if (render_skip == LCD_RENDER_ON_DEMAND) {
+      render_frame     = render_requested;
+      render_requested = false;
+   } else {
+      render_frame = skip_count == 0;
+      skip_count   = skip_count >= render_skip ? 0 : skip_count + 1;
+   }
+}
+
 // This fires the hardware VBLANK interrupt, not STAT
 void fire_vblank() {
-   ready = true;
+   ready          = true;
+   frame_rendered = render_frame;
+   frame_count++;
+   if (threaded) {
+      submit_frame(render_frame);
+   } else if (render_frame) {
+      publish_frame(frame_count);
+   }
    wbyte(IF, dread(IF) | INT_VBLANK);
 }
 
 void lcd_reset() {
+   lcd_sync();
+   if (shared == NULL) {
+      shared = calloc(1, sizeof(lcd_shared));
+   }
    disabled     = false;
    ready        = false;
    x_pixel      = 0;
@@ -161,6 +451,57 @@ void lcd_reset() {
    stat_vbl_on  = false;
    stat_oam_on  = false;
    stat_lyc_on  = false;
+   scroll_delay = 0;
+   skip_count   = 0;
+   frame_count  = 0;
+   shared->fb_back  = 0;
+   shared->fb_front = 2;
+   atomic_store(&shared->fb_middle, 1);
+   start_frame();
+}
+
+void lcd_save_state(lcd_snapshot* s) {
+   s->timer        = timer;
+   s->frame_count  = frame_count;
+   s->ignore_oams  = ignore_oams;
+   s->scroll_delay = scroll_delay;
+   s->mode         = mode;
+   s->ly           = ly;
+   s->win_y        = win_y;
+   s->win_ly       = win_ly;
+   s->x_pixel      = x_pixel;
+   s->stat_fired   = stat_fired;
+   s->disabled     = disabled;
+   s->ready        = ready;
+   s->stat_vbl_on  = stat_vbl_on;
+   s->stat_hbl_on  = stat_hbl_on;
+   s->stat_oam_on  = stat_oam_on;
+   s->stat_lyc_on  = stat_lyc_on;
+   s->vblank_fired = vblank_fired;
+   memset(s->unused, 0, sizeof(s->unused));
+}
+
+// Whether frames get drawn is up to the frontend, so the frame
+// skip settings are left as they are
+void lcd_load_state(const lcd_snapshot* s) {
+   lcd_sync();
+   timer        = s->timer;
+   frame_count  = s->frame_count;
+   ignore_oams  = s->ignore_oams;
+   scroll_delay = s->scroll_delay;
+   mode         = s->mode;
+   ly           = s->ly;
+   win_y        = s->win_y;
+   win_ly       = s->win_ly;
+   x_pixel      = s->x_pixel;
+   stat_fired   = s->stat_fired;
+   disabled     = s->disabled;
+   ready        = s->ready;
+   stat_vbl_on  = s->stat_vbl_on;
+   stat_hbl_on  = s->stat_hbl_on;
+   stat_oam_on  = s->stat_oam_on;
+   stat_lyc_on  = s->stat_lyc_on;
+   vblank_fired = s->vblank_fired;
 }
 
 void try_fire_oam() {
@@ -209,8 +550,8 @@ void try_fire_lyc() {
    }
 }
 
-// This used to do more, but now it just outputs
-// debug messages. Still useful.
+// This used to do more, but now it just outputs debug
+// messages and trace events. Still useful.
 void set_mode(lcd_mode new_mode) {
    if (mode != new_mode) {
       switch (new_mode) {
@@ -227,6 +568,10 @@ void set_mode(lcd_mode new_mode) {
             dbg_log("STAT mode switch: VRAM");
             break;
       }
+      if (trace_on) {
+         trace_end(TRACK_LCD);
+         trace_begin(TRACK_LCD, mode_names[new_mode], -1);
+      }
    }
    mode = new_mode;
 }
@@ -262,12 +607,15 @@ void lcd_reg_write(word addr, byte val) {
                // to last the same length as OAM mode
                timer = 200 - 84;
                try_fire_lyc();
+               start_frame();
             }
             disabled = false;
          } else {
             if (!disabled) {
-               ready    = true;
-               disabled = true;
+               ready          = true;
+               frame_rendered = render_frame;
+               disabled       = true;
+               submit_frame(false);
                ly       = 0;
                dbg_notify_write(LY, 0);
                set_mode(HBLANK);
@@ -329,11 +677,25 @@ void lcd_advance_time(cycle cycles) {
 #ifdef PER_PIXEL
          // Draw our current scanline one pixel at a time
          while (x_pixel < timer - 12 && x_pixel < 160) {
-            draw_pixel(x_pixel++, ly);
+            if (render_frame) {
+               draw_pixel(x_pixel, ly);
+               if (x_pixel == 159) {
+                  emit_line(shared->framebuffers[shared->fb_back], ly);
+               }
+            }
+            x_pixel++;
          }
 #else
          if (timer >= vram_length && x_pixel < 160) {
-            draw_scanline();
+            if (render_frame) {
+               queue_line();
+            }
+            // The window line counter has to advance even when
+            // the line isn't drawn, or the window will be misplaced
+            // on the next frame that is.
+            if (window_on_line()) {
+               win_ly++;
+            }
             x_pixel = 160;
          }
 #endif
@@ -381,6 +743,7 @@ void lcd_advance_time(cycle cycles) {
             if (ly == 1) {
                ly     = 0;
                win_ly = 0;
+               start_frame();
                set_mode(OAM);
                try_fire_oam();
             }
@@ -393,11 +756,19 @@ void lcd_advance_time(cycle cycles) {
    }
 }
 
+// True if the window covers any part of the current line
+bool window_on_line() {
+   byte win_x = dread(WINX);
+   return (dread(LCDC) & 0x20) && ly >= dread(WINY) && win_x < 166;
+}
+
 void draw_pixel(int x, int y) {
    if (x < 0 || x >= 160 || y < 0 || y >= 144) {
       return;
    }
 
+   byte* framebuffer = shared->framebuffers[shared->fb_back];
+
    // TODO: These should be changed on write to LCDC and stored.
    byte lcdc       = rbyte(LCDC);
    bool wn_tilemap = lcdc & (1 << 6);
@@ -516,44 +887,160 @@ void draw_pixel(int x, int y) {
    }
 }
 
-void draw_scanline() {
+// Snapshot of the registers used to draw the current line
+void capture_line(line_regs* r) {
+   r->lcdc   = dread(LCDC);
+   r->scx    = dread(SCX);
+   r->scy    = dread(SCY);
+   r->wx     = dread(WINX);
+   r->wy     = dread(WINY);
+   r->bgp    = dread(BGPAL);
+   r->obp0   = dread(OBJPAL);
+   r->obp1   = dread(OBJPAL + 1);
+   r->ly     = ly;
+   r->win_ly = win_ly;
+}
+
+// Draws one line from the registers and video memory as they are
+// now, outside of the LCD's timing. Only meant for benchmarks.
+void lcd_draw_line(byte line) {
+   line_regs r;
+   capture_line(&r);
+   r.ly     = line;
+   r.win_ly = line >= r.wy ? line - r.wy : 0;
+   byte* fb = shared->framebuffers[shared->fb_back];
+   draw_scanline(&r, mem_ptr(0x8000), mem_ptr(OAMSTART), fb);
+}
+
+// Draws the current line, or hands it to the render thread
+void queue_line() {
+   if (!threaded) {
+      TIMING_BEGIN(ZONE_RENDER);
+      line_regs r;
+      byte* fb = shared->framebuffers[shared->fb_back];
+      capture_line(&r);
+      draw_scanline(&r, mem_ptr(0x8000), mem_ptr(OAMSTART), fb);
+      emit_line(fb, r.ly);
+      TIMING_END();
+      return;
+   }
+
+   // Video memory is only copied again if it was written
+   // to since the last line we captured.
+   frame_job* job = &shared->jobs[job_fill];
+   uint32_t gen   = mem_video_generation();
+   if (job->copy_count == 0 || job->copy_gen != gen) {
+      video_copy* copy = &job->copies[job->copy_count++];
+      memcpy(copy->vram, mem_ptr(0x8000), VRAM_SIZE);
+      memcpy(copy->oam, mem_ptr(OAMSTART), OAM_SIZE);
+      job->copy_gen = gen;
+   }
+   capture_line(&job->lines[job->line_count]);
+   job->line_copy[job->line_count] = job->copy_count - 1;
+   job->line_count++;
+}
+
+// Hands the lines captured so far to the render thread. If publish
+// is set, they complete a frame that readers should see.
+void submit_frame(bool publish) {
+   frame_job* job = &shared->jobs[job_fill];
+   if (!threaded || (job->line_count == 0 && !publish)) {
+      return;
+   }
+   job->publish = publish;
+   job->frame   = frame_count;
+   pthread_mutex_lock(&shared->job_lock);
+   // Only one job can be drawn at a time. If the render thread
+   // is still busy with the last one, wait for it.
+   while (shared->job_queued != -1) {
+      pthread_cond_wait(&shared->job_cond, &shared->job_lock);
+   }
+   shared->job_queued = job_fill;
+   pthread_cond_broadcast(&shared->job_cond);
+   pthread_mutex_unlock(&shared->job_lock);
+
+   job_fill                          = !job_fill;
+   shared->jobs[job_fill].line_count = 0;
+   shared->jobs[job_fill].copy_count = 0;
+}
+
+// arg is the Game Boy's lcd_shared
+void* render_main(void* arg) {
+   shared = arg;
+   pthread_mutex_lock(&shared->job_lock);
+   while (true) {
+      while (shared->job_queued == -1 && !shared->render_quit) {
+         pthread_cond_wait(&shared->job_cond, &shared->job_lock);
+      }
+      if (shared->job_queued == -1) {
+         break;
+      }
+      frame_job* job = &shared->jobs[shared->job_queued];
+      pthread_mutex_unlock(&shared->job_lock);
+
+      for (int i = 0; i < job->line_count; ++i) {
+         video_copy* copy = &job->copies[job->line_copy[i]];
+         byte* fb         = shared->framebuffers[shared->fb_back];
+         draw_scanline(&job->lines[i], copy->vram, copy->oam, fb);
+         emit_line(fb, job->lines[i].ly);
+      }
+      if (job->publish) {
+         publish_frame(job->frame);
+      }
+
+      pthread_mutex_lock(&shared->job_lock);
+      shared->job_queued = -1;
+      pthread_cond_broadcast(&shared->job_cond);
+   }
+   pthread_mutex_unlock(&shared->job_lock);
+   return arg;
+}
+
+// Draws one line into out. Only reads the registers in r and the
+// given copies of VRAM and OAM, so it is safe to call from the
+// render thread.
+void draw_scanline(const line_regs* r,
+      const byte* vram,
+      const byte* oam,
+      byte* out) {
+   byte ly = r->ly;
    if (ly > 143) {
       return;
    }
 
    bool bg_is_zero[160];
    bool window       = false;
-   byte win_x        = dread(WINX);
-   byte win_y        = dread(WINY);
-   bool bg_enabled   = dread(LCDC) & 0x01;
-   bool win_tile_map = dread(LCDC) & 0x40;
-   bool bg_tile_map  = dread(LCDC) & 0x08;
-   bool tile_bank    = dread(LCDC) & 0x10;
-   byte scroll_x     = dread(SCX);
-   byte scroll_y     = dread(SCY);
-   word bg_map_loc   = 0x9800 + (bg_tile_map ? 0x400 : 0);
-   word win_map_loc  = 0x9800 + (win_tile_map ? 0x400 : 0);
+   byte win_x        = r->wx;
+   byte win_y        = r->wy;
+   bool bg_enabled   = r->lcdc & 0x01;
+   bool win_tile_map = r->lcdc & 0x40;
+   bool bg_tile_map  = r->lcdc & 0x08;
+   bool tile_bank    = r->lcdc & 0x10;
+   byte scroll_x     = r->scx;
+   byte scroll_y     = r->scy;
+   word bg_map_loc   = 0x1800 + (bg_tile_map ? 0x400 : 0);
+   word win_map_loc  = 0x1800 + (win_tile_map ? 0x400 : 0);
    word bg_map_off   = (((ly + scroll_y) & 0xFF) >> 3) * 32;
-   word win_map_off  = ((win_ly & 0xFF) >> 3) * 32;
+   word win_map_off  = ((r->win_ly & 0xFF) >> 3) * 32;
    byte bg_x_off     = (scroll_x >> 3) & 0x1F;
    byte win_x_off    = 0;
-   byte bg_tile      = dread(bg_map_loc + bg_map_off + bg_x_off);
-   byte win_tile     = dread(win_map_loc + win_map_off);
+   byte bg_tile      = vram[bg_map_loc + bg_map_off + bg_x_off];
+   byte win_tile     = vram[win_map_loc + win_map_off];
    byte bg_xpx_off   = scroll_x & 0x07;
    byte bg_ypx_off   = (scroll_y + ly) & 0x07;
-   byte win_ypx_off  = win_ly & 0x07;
+   byte win_ypx_off  = r->win_ly & 0x07;
    byte start_x_off  = bg_xpx_off;
    byte win_xpx_off  = 0;
    byte win_x_px     = 0;
 
    for (int i = 0; i < 160; i++) {
-      if ((dread(LCDC) & 0x20) && ly >= win_y && i >= win_x - 7
-            && win_x < 166) {
+      if ((r->lcdc & 0x20) && ly >= win_y && i >= win_x - 7 && win_x < 166) {
          window = true;
       }
 
+      // Tile addresses are relative to the start of VRAM
       byte tile_index = window ? win_tile : bg_tile;
-      int tile_addr   = 0x8000;
+      int tile_addr   = 0;
       if (tile_index < 128) {
          if (tile_bank) {
             tile_addr += tile_index * 16;
@@ -577,8 +1064,8 @@ void draw_scanline() {
          mask <<= 7 - ((win_x_px++) & 0x07);
       }
 
-      byte hi  = dread(tile_addr + 1);
-      byte lo  = dread(tile_addr);
+      byte hi  = vram[tile_addr + 1];
+      byte lo  = vram[tile_addr];
       byte col = 0;
       if (hi & mask) {
          col = 2;
@@ -589,8 +1076,8 @@ void draw_scanline() {
 
       bg_is_zero[i] = true;
       if (bg_enabled || window) {
-         bg_is_zero[i]             = col == 0;
-         framebuffer[ly * 160 + i] = color(col, dread(BGPAL));
+         bg_is_zero[i]     = col == 0;
+         out[ly * 160 + i] = color(col, r->bgp);
 
          if (!window) {
             bg_xpx_off++;
@@ -598,7 +1085,7 @@ void draw_scanline() {
                bg_xpx_off = 0;
                bg_x_off++;
                bg_x_off &= 0x1F;
-               bg_tile = dread(bg_map_loc + bg_map_off + bg_x_off);
+               bg_tile = vram[bg_map_loc + bg_map_off + bg_x_off];
             }
          } else {
             win_xpx_off++;
@@ -606,30 +1093,26 @@ void draw_scanline() {
                win_xpx_off = 0;
                win_x_off++;
                win_x_off &= 0x1F;
-               win_tile = dread(win_map_loc + win_map_off + win_x_off);
+               win_tile = vram[win_map_loc + win_map_off + win_x_off];
             }
          }
       } else {
-         framebuffer[ly * 160 + i] = C_WHITE;
+         out[ly * 160 + i] = C_WHITE;
       }
    }
 
-   if (window) {
-      win_ly++;
-   }
-
    // Check if sprites are enabled
-   if (!(dread(LCDC) & 0x02)) {
+   if (!(r->lcdc & 0x02)) {
       return;
    }
 
    // Begin sprite drawing
-   bool big_sprites = dread(LCDC) & 0x04;
+   bool big_sprites = r->lcdc & 0x04;
    for (int spr = 0; spr < 40; spr++) {
-      byte y     = dread(OAMSTART + spr * 4);
-      byte x     = dread(OAMSTART + spr * 4 + 1);
-      byte tile  = dread(OAMSTART + spr * 4 + 2);
-      byte attr  = dread(OAMSTART + spr * 4 + 3);
+      byte y     = oam[spr * 4];
+      byte x     = oam[spr * 4 + 1];
+      byte tile  = oam[spr * 4 + 2];
+      byte attr  = oam[spr * 4 + 3];
       bool pal   = attr & 0x10;
       bool xflip = attr & 0x20;
       bool yflip = attr & 0x40;
@@ -656,9 +1139,9 @@ void draw_scanline() {
          }
 
          byte y_mask   = height - 1;
-         word spr_addr = 0x8000 + spr_index * 16 + (spr_line & y_mask) * 2;
-         byte shi      = dread(spr_addr + 1);
-         byte slo      = dread(spr_addr);
+         word spr_addr = spr_index * 16 + (spr_line & y_mask) * 2;
+         byte shi      = vram[spr_addr + 1];
+         byte slo      = vram[spr_addr];
 
          for (int sx = 0; sx < 8; sx++) {
             byte smask;
@@ -679,8 +1162,8 @@ void draw_scanline() {
                if (pri == 1 && !bg_is_zero[draw_x + sx]) {
                   continue;
                }
-               framebuffer[ly * 160 + draw_x + sx] =
-                     color(scol, dread(OBJPAL + pal));
+               out[ly * 160 + draw_x + sx] =
+                     color(scol, pal ? r->obp1 : r->obp0);
             }
          }
       }
@@ -4,7 +4,45 @@
 #include "cpu.h"
 #include "defines.h"
 
+// Pass to lcd_set_frame_skip to only draw requested frames
+#define LCD_RENDER_ON_DEMAND -1
+
+// Pixel formats for lcd_set_output
+typedef enum lcd_format_ {
+   LCD_INDEX8,  // Shade from 0 (white) to 3 (black)
+   LCD_GREY8,   // Same values as the framebuffer
+   LCD_RGB565,  // 16 bits per pixel
+   LCD_XRGB8888 // 32 bits per pixel, X is set to 0xFF
+} lcd_format;
+
+// What other threads need to read a Game Boy's frames
+typedef struct lcd_shared_ lcd_shared;
+
+// The LCD's timing and interrupt state. Its registers are in memory.
+// Part of the save state format, so the layout is fixed.
+typedef struct lcd_snapshot_ {
+   int64_t timer;
+   uint32_t frame_count;
+   int32_t ignore_oams;
+   int32_t scroll_delay;
+   byte mode;
+   byte ly;
+   byte win_y;
+   byte win_ly;
+   byte x_pixel;
+   byte stat_fired;
+   byte disabled;
+   byte ready;
+   byte stat_vbl_on;
+   byte stat_hbl_on;
+   byte stat_oam_on;
+   byte stat_lyc_on;
+   byte vblank_fired;
+   byte unused[7];
+} lcd_snapshot;
+
 void lcd_reset();
+void lcd_free();
 void lcd_advance_time(cycle cycles);
 byte lcd_reg_read(word addr);
 void lcd_reg_write(word addr, byte val);
@@ -14,4 +52,16 @@ bool lcd_vram_accessible();
 bool lcd_oam_accessible();
 bool lcd_ready();
 byte* lcd_get_framebuffer();
+byte* lcd_latest_frame(uint32_t* frame);
+void lcd_set_output(lcd_format format, void* pixels, int pitch);
+void lcd_set_frame_skip(int skip);
+void lcd_request_frame();
+bool lcd_frame_rendered();
+void lcd_set_threaded(bool on);
+void lcd_sync();
+void lcd_draw_line(byte line);
+lcd_shared* lcd_get_shared();
+void lcd_select(lcd_shared* s);
+void lcd_save_state(lcd_snapshot* s);
+void lcd_load_state(const lcd_snapshot* s);
 #endif
@@ -3,20 +3,87 @@
 
 #include "cpu.h"
 #include "debugger.h"
+#include "gb.h"
+#include "headless.h"
+#include "input.h"
 #include "lcd.h"
 #include "memory.h"
+#include "pacing.h"
+#include "present.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "timing.h"
+#include "trace.h"
 
 #define INPUT_POLL_RATE 12 // Poll for input every 12 ms
 #define SCALE_FACTOR 2
 
+// A minute of rewind, and more memory than that should ever need
+#define REWIND_FRAMES 3600
+#define REWIND_BYTES (32 << 20)
+
+gb_t game; // For the event thread, which doesn't run it
+
+// Runs on SDL's event thread when there is one. Joypad keys are
+// stamped with the time they arrived and queued for the core, so
+// they don't wait for the main loop to poll. Everything else is
+// left for the main loop.
+int joypad_filter(const SDL_Event* event) {
+   if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) {
+      return 1;
+   }
+   int64_t now  = pacing_now();
+   bool pressed = event->type == SDL_KEYDOWN;
+   gb_select(game);
+   switch (event->key.keysym.sym) {
+      case SDLK_LEFT:
+         input_push_host(now, INPUT_DPAD, LEFT, pressed);
+         return 0;
+      case SDLK_UP:
+         input_push_host(now, INPUT_DPAD, UP, pressed);
+         return 0;
+      case SDLK_RIGHT:
+         input_push_host(now, INPUT_DPAD, RIGHT, pressed);
+         return 0;
+      case SDLK_DOWN:
+         input_push_host(now, INPUT_DPAD, DOWN, pressed);
+         return 0;
+      case SDLK_z: // A
+         input_push_host(now, INPUT_BUTTON, A, pressed);
+         return 0;
+      case SDLK_x: // B
+         input_push_host(now, INPUT_BUTTON, B, pressed);
+         return 0;
+      case SDLK_RETURN: // Start
+         input_push_host(now, INPUT_BUTTON, START, pressed);
+         return 0;
+      case SDLK_RSHIFT: // Select
+         input_push_host(now, INPUT_BUTTON, SELECT, pressed);
+         return 0;
+      default:
+         break;
+   }
+   return 1;
+}
+
 int main(int argc, char* args[]) {
    if (argc < 2) {
       printf("USAGE: %s <binary> [-i]\n", args[0]);
       exit(0);
    }
 
+   for (int a = 1; a < argc; ++a) {
+      if (strcmp(args[a], "--headless") == 0) {
+         return headless_main(argc, args);
+      }
+   }
+
    bool rand_input = false;
    bool debug_flag = false;
+   bool threaded   = false;
+   int scale       = SCALE_FACTOR;
+   int ahead       = 0;
+   char* trace     = NULL;
    if (argc > 2) {
       for (int a = 0; a < argc - 2; ++a) {
          if (strcmp(args[a + 2], "-i") == 0) {
@@ -36,17 +103,41 @@ int main(int argc, char* args[]) {
          if (strcmp(args[a + 2], "-r") == 0) {
             rand_input = true;
          }
+         if (strcmp(args[a + 2], "-t") == 0) {
+            threaded = true;
+         }
+         if (strcmp(args[a + 2], "--trace") == 0 && a + 3 < argc) {
+            trace = args[a + 3];
+         }
+         if (strcmp(args[a + 2], "-s") == 0 && a + 3 < argc) {
+            scale = atoi(args[a + 3]);
+            if (scale < 1 || scale > 4) {
+               fprintf(stderr, "Scale must be from 1 to 4\n");
+               exit(1);
+            }
+         }
+         if (strcmp(args[a + 2], "--run-ahead") == 0 && a + 3 < argc) {
+            ahead = atoi(args[a + 3]);
+            if (ahead < 0 || ahead > 4) {
+               fprintf(stderr, "Run-ahead must be from 0 to 4 frames\n");
+               exit(1);
+            }
+         }
       }
    }
 
    uint32_t screenFlags = SDL_HWSURFACE | SDL_DOUBLEBUF;
-   SDL_Init(SDL_INIT_EVERYTHING);
+   // Ask for a separate event thread so joypad input is picked
+   // up as it happens. Not every platform has one.
+   if (SDL_Init(SDL_INIT_EVERYTHING | SDL_INIT_EVENTTHREAD) < 0) {
+      SDL_Init(SDL_INIT_EVERYTHING);
+   }
    SDL_WM_SetCaption("Danger Boy", "Danger Boy");
    SDL_Surface* screen = SDL_SetVideoMode(
-         160 * SCALE_FACTOR, 144 * SCALE_FACTOR, 32, screenFlags);
+         160 * scale, 144 * scale, 32, screenFlags);
    SDL_Surface* gb_screen = SDL_CreateRGBSurface(SDL_HWSURFACE,
-         160 * SCALE_FACTOR,
-         144 * SCALE_FACTOR,
+         160 * scale,
+         144 * scale,
          32,
          0x00FF0000,
          0x0000FF00,
@@ -55,21 +146,36 @@ int main(int argc, char* args[]) {
 
    bool is_running = true;
    bool turbo      = false;
+   bool rewinding  = false;
+   int frame_skip  = 0;
    int turbo_skip  = 3;
-   int turbo_count = 0;
-   int t_prev      = SDL_GetTicks();
    int i_prev      = SDL_GetTicks();
    char* file      = args[1];
    bool break_next = false;
 
-   mem_init();
-   mem_load_image(file);
-   dbg_init();
-   cpu_init();
-   lcd_reset();
+   // One save state slot per ROM, kept next to it
+   char state_file[1024];
+   snprintf(state_file, sizeof(state_file), "%s.state", file);
+
+   present_filter filter = PRESENT_NEAREST;
+
+   gb_init(file);
+   game = gb_self();
+   rewind_init(REWIND_FRAMES, REWIND_BYTES);
+   runahead_init(ahead);
+   lcd_set_threaded(threaded);
+   if (trace != NULL) {
+      trace_start(trace);
+   }
+
+   // Have the LCD output pixels in the same format as gb_screen
+   static uint32_t lcd_pixels[160 * 144];
+   lcd_set_output(LCD_XRGB8888, lcd_pixels, 160 * sizeof(uint32_t));
+
    if (debug_flag) {
       dbg_break();
    }
+   SDL_SetEventFilter(joypad_filter);
    bool rand_press  = false;
    byte rand_button = 0;
    int rand_timer   = 1500 / INPUT_POLL_RATE; // Don't push anything for 1.5s
@@ -113,29 +219,8 @@ int main(int argc, char* args[]) {
                   if (event.key.keysym.sym == SDLK_SPACE) {
                      turbo = false;
                   }
-                  if (event.key.keysym.sym == SDLK_LEFT) {
-                     release_dpad(LEFT);
-                  }
-                  if (event.key.keysym.sym == SDLK_UP) {
-                     release_dpad(UP);
-                  }
-                  if (event.key.keysym.sym == SDLK_RIGHT) {
-                     release_dpad(RIGHT);
-                  }
-                  if (event.key.keysym.sym == SDLK_DOWN) {
-                     release_dpad(DOWN);
-                  }
-                  if (event.key.keysym.sym == SDLK_z) { // A
-                     release_button(A);
-                  }
-                  if (event.key.keysym.sym == SDLK_x) { // B
-                     release_button(B);
-                  }
-                  if (event.key.keysym.sym == SDLK_RETURN) { // Start
-                     release_button(START);
-                  }
-                  if (event.key.keysym.sym == SDLK_RSHIFT) { // Select
-                     release_button(SELECT);
+                  if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                     rewinding = false;
                   }
                   break;
 
@@ -143,35 +228,26 @@ int main(int argc, char* args[]) {
                   if (event.key.keysym.sym == SDLK_d) {
                      dbg_break();
                   }
+                  if (event.key.keysym.sym == SDLK_f) {
+                     filter = (filter + 1) % PRESENT_FILTER_COUNT;
+                     printf("Filter: %s\n", present_filter_name(filter));
+                  }
                   if (event.key.keysym.sym == SDLK_n) {
                      break_next = true; // Break after the next input is given
                   }
                   if (event.key.keysym.sym == SDLK_SPACE) {
                      turbo = true;
                   }
-                  if (event.key.keysym.sym == SDLK_LEFT) {
-                     press_dpad(LEFT);
-                  }
-                  if (event.key.keysym.sym == SDLK_UP) {
-                     press_dpad(UP);
-                  }
-                  if (event.key.keysym.sym == SDLK_RIGHT) {
-                     press_dpad(RIGHT);
-                  }
-                  if (event.key.keysym.sym == SDLK_DOWN) {
-                     press_dpad(DOWN);
-                  }
-                  if (event.key.keysym.sym == SDLK_z) { // A
-                     press_button(A);
+                  if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                     rewinding = true;
                   }
-                  if (event.key.keysym.sym == SDLK_x) { // B
-                     press_button(B);
+                  if (event.key.keysym.sym == SDLK_F5
+                        && gb_save_state_file(state_file)) {
+                     printf("Saved state to %s\n", state_file);
                   }
-                  if (event.key.keysym.sym == SDLK_RETURN) { // Start
-                     press_button(START);
-                  }
-                  if (event.key.keysym.sym == SDLK_RSHIFT) { // Select
-                     press_button(SELECT);
+                  if (event.key.keysym.sym == SDLK_F8
+                        && gb_load_state_file(state_file)) {
+                     printf("Loaded state from %s\n", state_file);
                   }
                   break;
                case SDL_QUIT:
@@ -181,6 +257,18 @@ int main(int argc, char* args[]) {
                   break;
             }
          }
+
+         // In turbo, the LCD only draws every turbo_skip + 1 frames.
+         // Running ahead draws the frames it shows, so none of the
+         // others need drawing.
+         int skip = turbo ? turbo_skip : 0;
+         if (ahead > 0 && !turbo && !rewinding) {
+            skip = LCD_RENDER_ON_DEMAND;
+         }
+         if (skip != frame_skip) {
+            lcd_set_frame_skip(skip);
+            frame_skip = skip;
+         }
       }
       // We pause execution when the screen is ready to
       // be flipped to prevent emulating faster than 60 fps
@@ -188,26 +276,43 @@ int main(int argc, char* args[]) {
          // If we aren't ready to render, check if the debugger
          // wants to break. Otherwise, execute an opcode and
          // advance time.
-         if (dbg_should_break()) {
-            dbg_cli();
-         }
-         cpu_execute_step();
+         gb_step();
       } else {
-         // If we're skipping frames, only draw every turbo_skip frame
-         if (turbo) {
-            if (turbo_count < turbo_skip) {
-               turbo_count++;
-               continue;
-            }
-            turbo_count = 0;
+         TIMING_FRAME();
+
+         // While rewinding, each frame goes back two: one loaded from
+         // the history, then one emulated forward again to be shown
+         if (rewinding) {
+            rewind_step();
+         } else {
+            rewind_capture();
+         }
+
+         // Show where the game will be a few frames from now, so it
+         // seems to react to buttons that much sooner
+         if (frame_skip == LCD_RENDER_ON_DEMAND) {
+            runahead_run();
          }
 
-         // Delay until we're rendering at 60fps
-         while (t - t_prev < 16 && !turbo) {
-            SDL_Delay(1);
-            t = SDL_GetTicks();
+         // Skipped frames have nothing new to show
+         if (!lcd_frame_rendered() && !lcd_disabled()) {
+            continue;
+         }
+
+         // Wait until this frame is due. Turbo runs unpaced,
+         // so the schedule starts over from wherever it ends.
+         int64_t waited = pacing_now();
+         TIMING_BEGIN(ZONE_IDLE);
+         if (turbo) {
+            pacing_reset();
+         } else {
+            pacing_wait_frame();
          }
-         t_prev = t;
+         TIMING_END();
+         if (trace_on) {
+            trace_host("Wait", waited, pacing_now());
+         }
+         input_sync_clock(pacing_now(), cpu_ticks);
 
          // If the LCD is off, just draw white to the screen
          if (lcd_disabled()) {
@@ -216,36 +321,27 @@ int main(int argc, char* args[]) {
             continue;
          }
 
-         // Copy the LCD framebuffer to the display. We expand
-         // the framebuffer from 1 value per pixel (greyscale)
-         // to RGB here.
+         // The LCD has already written 32 bit pixels into lcd_pixels,
+         // so all that's left is scaling them up to the display.
+         int64_t shown = pacing_now();
+         TIMING_BEGIN(ZONE_PRESENT);
+         lcd_sync();
          SDL_LockSurface(gb_screen);
-
-         uint8_t* framebuffer = lcd_get_framebuffer();
-         uint8_t* display     = gb_screen->pixels;
-         int pitch            = gb_screen->pitch;
-         int bpp              = gb_screen->format->BytesPerPixel;
-         for (int y = 0; y < gb_screen->h; ++y) {
-            for (int x = 0; x < gb_screen->w; ++x) {
-               // Set Alpha channel to 255
-               display[y * pitch + x * bpp + 3] = 255;
-               for (int c = 0; c < 3; ++c) {
-                  int small_x = x / SCALE_FACTOR;
-                  int small_y = y / SCALE_FACTOR;
-                  display[y * pitch + x * bpp + c] =
-                        framebuffer[small_y * 160 + small_x];
-               }
-            }
-         }
-
+         present_frame(
+               lcd_pixels, gb_screen->pixels, gb_screen->pitch, scale, filter);
          SDL_UnlockSurface(gb_screen);
          SDL_BlitSurface(gb_screen, NULL, screen, NULL);
          SDL_Flip(screen);
+         TIMING_END();
+         if (trace_on) {
+            trace_host("Present", shown, pacing_now());
+         }
       }
    }
 
    SDL_Quit();
-   dbg_free();
-   mem_free();
+   pacing_report(stdout);
+   runahead_report(stdout);
+   gb_free();
    return 0;
 }
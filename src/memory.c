@@ -7,6 +7,11 @@
 #include "debugger.h"
 #include "lcd.h"
 #include "memory.h"
+#include "timing.h"
+#include "trace.h"
+
+// Pages of ram and banked_ram, 256 bytes each
+#define MEM_PAGES 0x200
 
 typedef enum mbc_type_ { NONE = 0, MBC1 = 1, MBC2 = 2, MBC3 = 3 } mbc_type;
 
@@ -23,22 +28,38 @@ typedef enum dma_state_ {
 // Internal variables
 // ------------------
 
-dma_state dma;
-mbc_type mbc;
-mbc_bankmode banking;
-word dma_src, dma_dst, dma_rst;
-bool ram_locked;
-byte rom_banks;
-byte ram_banks;
-byte rom_bank;
-byte ram_bank;
-byte* ram;
-byte* rom;
-byte* banked_ram;
-char rom_name[16];
-byte joy_dpad;
-byte joy_buttons;
-byte joy_last_write;
+_Thread_local dma_state dma;
+_Thread_local mbc_type mbc;
+_Thread_local mbc_bankmode banking;
+_Thread_local word dma_src, dma_dst, dma_rst;
+_Thread_local bool ram_locked;
+_Thread_local byte rom_banks;
+_Thread_local byte ram_banks;
+_Thread_local byte rom_bank;
+_Thread_local byte ram_bank;
+_Thread_local byte* ram;
+_Thread_local byte* rom;
+_Thread_local byte* banked_ram;
+_Thread_local char rom_name[16];
+_Thread_local byte joy_dpad;
+_Thread_local byte joy_buttons;
+_Thread_local byte joy_last_write;
+
+// Incremented on every write to VRAM or OAM, so the LCD can tell
+// when its copy of video memory is out of date.
+_Thread_local uint32_t video_gen;
+
+_Thread_local int traced_bank; // Last ROM bank sent to the trace, or -1
+
+// The last bytes sent over the link cable, newest last
+_Thread_local char serial_tail[8];
+
+// The write generation each 256 byte page was last written in, so an
+// incremental save state can copy only what changed. Pages 0x00 -
+// 0xFF are ram's, and 0x100 - 0x1FF banked_ram's. Stamping costs a
+// store per write, where clearable dirty bits would cost a load too.
+_Thread_local uint32_t* page_gen;
+_Thread_local uint32_t write_gen;
 
 // ------------------
 // Internal functions
@@ -46,19 +67,40 @@ byte joy_last_write;
 
 void start_dma(byte val);
 byte get_rom_bank();
+void write_bus(word addr, byte val);
+byte read_bus(word addr);
+void trace_bank();
+void serial_send(byte c);
+void stamp_all_pages();
+void save_registers(mem_snapshot* s);
+void load_registers(const mem_snapshot* s);
 
 // --------------------
 // Function definitions
 // --------------------
 
 void dwrite(word addr, byte val) {
-   ram[addr] = val;
+   ram[addr]           = val;
+   page_gen[addr >> 8] = write_gen;
 }
 
 byte dread(word addr) {
    return ram[addr];
 }
 
+byte* mem_ptr(word addr) {
+   return ram + addr;
+}
+
+uint32_t mem_video_generation() {
+   return video_gen;
+}
+
+// The bank mapped at 0x4000 - 0x7FFF
+byte mem_rom_bank() {
+   return get_rom_bank() % rom_banks;
+}
+
 void press_button(button but) {
    joy_buttons &= ~but;
    wbyte(IF, rbyte(IF) | INT_INPUT);
@@ -77,8 +119,13 @@ void release_dpad(dpad dir) {
    joy_dpad |= dir;
 }
 
+byte joypad_held() {
+   return (~joy_buttons & 0x0F) | (~joy_dpad & 0x0F) << 4;
+}
+
+// Memory from a previous mem_init on this thread is cleared and
+// reused rather than allocated again
 void mem_init(void) {
-   mem_free();
    dma_dst        = 0;
    dma_src        = 0;
    dma_rst        = 0;
@@ -93,8 +140,17 @@ void mem_init(void) {
    joy_dpad       = 0x0F;
    joy_last_write = 0;
    dma            = INACTIVE;
-   ram            = (byte*)calloc(0x10000, 1);
-   banked_ram     = (byte*)calloc(0x10000, 1);
+   video_gen      = 0;
+   traced_bank    = -1;
+   memset(serial_tail, 0, sizeof(serial_tail));
+   if (ram == NULL) {
+      ram        = (byte*)malloc(0x10000);
+      banked_ram = (byte*)malloc(0x10000);
+      page_gen   = malloc(MEM_PAGES * sizeof(uint32_t));
+   }
+   memset(ram, 0, 0x10000);
+   memset(banked_ram, 0, 0x10000);
+   stamp_all_pages();
 }
 
 void mem_free() {
@@ -108,6 +164,9 @@ void mem_free() {
    }
    banked_ram = NULL;
 
+   free(page_gen);
+   page_gen = NULL;
+
    if (rom != NULL) {
       free(rom);
    }
@@ -115,7 +174,6 @@ void mem_free() {
 }
 
 void mem_load_image(char* fname) {
-   assert(ram != NULL);
    FILE* fin = fopen(fname, "rb");
    if (fin == NULL) {
       fprintf(stderr, "Could not open file %s\n", fname);
@@ -123,49 +181,57 @@ void mem_load_image(char* fname) {
       exit(1);
    }
 
-   // Load the first 32kb of the ROM to RAM
-   uint32_t i = 0;
-   while (!feof(fin) && i < 0x8000) {
-      byte data         = 0;
-      size_t bytes_read = fread(&data, 1, 1, fin);
-      if (bytes_read != 1) {
-         fprintf(stderr, "Error reading %s\n", fname);
-         fclose(fin);
-         mem_free();
-         exit(1);
-      }
-      ram[i] = data;
-      i++;
+   fseek(fin, 0, SEEK_END);
+   long size = ftell(fin);
+   fseek(fin, 0, SEEK_SET);
+   byte* data = size > 0 ? malloc(size) : NULL;
+   if (data == NULL || fread(data, 1, size, fin) != (size_t)size) {
+      fprintf(stderr, "Error reading %s\n", fname);
+      free(data);
+      fclose(fin);
+      mem_free();
+      exit(1);
+   }
+   fclose(fin);
+
+   bool loaded = mem_load_rom(data, size);
+   free(data);
+   if (!loaded) {
+      fprintf(stderr, "Error loading %s\n", fname);
+      mem_free();
+      exit(1);
    }
+}
+
+// Loads a cartridge from memory. The data is copied, so the caller
+// can free it afterwards. Returns false if it isn't a usable ROM.
+bool mem_load_rom(const byte* data, size_t size) {
+   assert(ram != NULL);
+
+   // The first 32kb of the ROM is mapped straight into RAM
+   if (size < 0x8000) {
+      fprintf(stderr, "ROM is smaller than 32kb\n");
+      return false;
+   }
+   memcpy(ram, data, 0x8000);
 
    int rom_size = dread(ROMSIZE);
    if (rom_size < 8) {
       rom_banks = pow(2, rom_size + 1);
       rom_size  = rom_banks * 0x4000;
-      rom       = calloc(rom_size, 1);
    } else {
       fprintf(stderr, "Unsupported bank configuration: %02X\n", rom_size);
-      mem_free();
-      exit(1);
+      return false;
    }
-
-   // Store the entire cart in ROM so we can bank
-   fseek(fin, 0, SEEK_SET);
-   i = 0;
-   while (!feof(fin) && i < rom_size) {
-      byte data;
-      size_t bytes_read = fread(&data, 1, 1, fin);
-      if (bytes_read != 1) {
-         fprintf(stderr, "Error reading %s\n", fname);
-         fclose(fin);
-         mem_free();
-         exit(1);
-      }
-      rom[i] = data;
-      i++;
+   if (size < (size_t)rom_size) {
+      fprintf(stderr, "ROM is smaller than its header says\n");
+      return false;
    }
 
-   fclose(fin);
+   // Store the entire cart in ROM so we can bank
+   free(rom);
+   rom = malloc(rom_size);
+   memcpy(rom, data, rom_size);
 
    // Determine cart type. Fallthrough is intentional.
    switch (ram[CARTTYPE]) {
@@ -237,6 +303,7 @@ void mem_load_image(char* fname) {
    // 16 bytes at ROMNAME contain game title in upper case
    memcpy(rom_name, ram + ROMNAME, 14);
    rom_name[15] = '\0';
+   return true;
 }
 
 void mem_print_rom_info() {
@@ -249,12 +316,18 @@ void mem_print_rom_info() {
 void start_dma(byte val) {
    if (dma == INACTIVE) {
       dbg_log("OAM DMA Starting");
+      if (trace_on) {
+         trace_begin(TRACK_DMA, "OAM DMA", val);
+      }
       dma     = STARTING;
       dma_src = val << 8;
       dma_dst = OAMSTART;
       ;
    } else {
       dbg_log("OAM DMA Restarting");
+      if (trace_on) {
+         trace_instant(TRACK_DMA, "Restart", val);
+      }
       dma     = RESTARTING;
       dma_rst = val << 8;
    }
@@ -262,6 +335,7 @@ void start_dma(byte val) {
 
 void mem_advance_time(cycle ticks) {
    if (dma != INACTIVE) {
+      TIMING_BEGIN(ZONE_DMA);
       while (ticks > 0) {
          ticks -= 4;
          if (dma == STARTING) {
@@ -271,6 +345,7 @@ void mem_advance_time(cycle ticks) {
          }
 
          dwrite(dma_dst, rbyte(dma_src));
+         video_gen++;
 
          dma_dst++;
          dma_src++;
@@ -278,6 +353,9 @@ void mem_advance_time(cycle ticks) {
             dma_dst = 0;
             dma_src = 0;
             dbg_log("OAM DMA Finish");
+            if (trace_on) {
+               trace_end(TRACK_DMA);
+            }
             dma = INACTIVE;
             break;
          }
@@ -290,6 +368,7 @@ void mem_advance_time(cycle ticks) {
             continue;
          }
       }
+      TIMING_END();
    }
 }
 
@@ -313,8 +392,142 @@ byte get_rom_bank() {
    return rom_bank & 0x7F;
 }
 
+void mem_save_state(mem_snapshot* s) {
+   memcpy(s->ram, ram + 0x8000, sizeof(s->ram));
+   memcpy(s->banked_ram, banked_ram, sizeof(s->banked_ram));
+   save_registers(s);
+}
+
+// Everything in a snapshot but the pages
+void save_registers(mem_snapshot* s) {
+   memcpy(s->header, rom + 0x100, sizeof(s->header));
+   s->dma_src        = dma_src;
+   s->dma_dst        = dma_dst;
+   s->dma_rst        = dma_rst;
+   s->dma            = dma;
+   s->banking        = banking;
+   s->ram_locked     = ram_locked;
+   s->rom_bank       = rom_bank;
+   s->ram_bank       = ram_bank;
+   s->joy_dpad       = joy_dpad;
+   s->joy_buttons    = joy_buttons;
+   s->joy_last_write = joy_last_write;
+   memset(s->unused, 0, sizeof(s->unused));
+   memcpy(s->serial_tail, serial_tail, sizeof(serial_tail));
+}
+
+// Returns false, changing nothing, if the snapshot was taken with
+// a different ROM loaded
+bool mem_load_state(const mem_snapshot* s) {
+   if (memcmp(s->header, rom + 0x100, sizeof(s->header)) != 0) {
+      return false;
+   }
+   memcpy(ram + 0x8000, s->ram, sizeof(s->ram));
+   memcpy(banked_ram, s->banked_ram, sizeof(s->banked_ram));
+   load_registers(s);
+   // Every page may differ from what an incremental state holds
+   stamp_all_pages();
+   return true;
+}
+
+// Copying the pages back counts as writing them, so they still look
+// written to any other incremental state
+void mem_restore_state(const mem_snapshot* s, uint32_t since) {
+   for (int i = 0; i < MEM_SNAPSHOT_PAGES; ++i) {
+      int page = i + 0x80;
+      if (page_gen[page] < since) {
+         continue;
+      }
+      byte* to         = page < 0x100 ? ram + page * 0x100
+                                      : banked_ram + (page - 0x100) * 0x100;
+      const byte* from = i < 0x80 ? s->ram + i * 0x100
+                                  : s->banked_ram + (i - 0x80) * 0x100;
+      memcpy(to, from, 0x100);
+      page_gen[page] = write_gen;
+   }
+   load_registers(s);
+}
+
+void load_registers(const mem_snapshot* s) {
+   dma_src        = s->dma_src;
+   dma_dst        = s->dma_dst;
+   dma_rst        = s->dma_rst;
+   dma            = s->dma;
+   banking        = s->banking;
+   ram_locked     = s->ram_locked;
+   rom_bank       = s->rom_bank;
+   ram_bank       = s->ram_bank;
+   joy_dpad       = s->joy_dpad;
+   joy_buttons    = s->joy_buttons;
+   joy_last_write = s->joy_last_write;
+   memcpy(serial_tail, s->serial_tail, sizeof(serial_tail));
+   // Video memory changed under the LCD
+   video_gen++;
+   traced_bank = -1;
+}
+
+// Generations only go up, even across mem_init, so a state updated
+// before a new ROM was loaded still sees every page as written
+void stamp_all_pages() {
+   write_gen++;
+   for (int i = 0; i < MEM_PAGES; ++i) {
+      page_gen[i] = write_gen;
+   }
+}
+
+// Pages up to 0x7F are ROM, and the rest are in snapshot order
+uint32_t mem_update_state(mem_snapshot* s, uint32_t since, bool* changed) {
+   for (int i = 0; i < MEM_SNAPSHOT_PAGES; ++i) {
+      int page  = i + 0x80;
+      bool copy = page_gen[page] >= since;
+      if (copy) {
+         byte* from = page < 0x100 ? ram + page * 0x100
+                                   : banked_ram + (page - 0x100) * 0x100;
+         byte* to   = i < 0x80 ? s->ram + i * 0x100
+                               : s->banked_ram + (i - 0x80) * 0x100;
+         memcpy(to, from, 0x100);
+      }
+      if (changed != NULL) {
+         changed[i] = copy;
+      }
+   }
+   save_registers(s);
+   // Writes from here on are newer than this update
+   return ++write_gen;
+}
+
 // Write byte
 void wbyte(word addr, byte val) {
+   TIMING_BEGIN(ZONE_MEMORY);
+   write_bus(addr, val);
+   if (trace_on && addr < 0x8000) {
+      trace_bank();
+   }
+   TIMING_END();
+}
+
+// Blargg's test ROMs finish by printing Passed or Failed
+void serial_send(byte c) {
+   memmove(serial_tail, serial_tail + 1, sizeof(serial_tail) - 1);
+   serial_tail[sizeof(serial_tail) - 1] = c;
+   const char* end = serial_tail + sizeof(serial_tail) - 6;
+   if (memcmp(end, "Passed", 6) == 0) {
+      cpu_test_result = TEST_PASSED;
+   } else if (memcmp(end, "Failed", 6) == 0) {
+      cpu_test_result = TEST_FAILED;
+   }
+}
+
+// Records the mapped ROM bank if an MBC write changed it
+void trace_bank() {
+   int bank = mem_rom_bank();
+   if (bank != traced_bank) {
+      trace_instant(TRACK_BANK, "ROM bank", bank);
+      traced_bank = bank;
+   }
+}
+
+void write_bus(word addr, byte val) {
    dbg_notify_write(addr, val);
 
    switch (addr & 0xF000) {
@@ -400,34 +613,40 @@ void wbyte(word addr, byte val) {
       case 0x8000: // VRAM
       case 0x9000:
          if (lcd_vram_accessible()) {
-            ram[addr] = val;
+            ram[addr]           = val;
+            page_gen[addr >> 8] = write_gen;
+            video_gen++;
          }
          return;
       case 0xA000: // External RAM
       case 0xB000:
          if (mbc == NONE) {
-            ram[addr] = val;
+            ram[addr]           = val;
+            page_gen[addr >> 8] = write_gen;
             return;
          }
          if (ram_locked == false) {
             addr -= 0xA000;
             if (mbc == MBC3 || banking == ROM4_RAM32) {
-               banked_ram[(addr + ram_bank * 0x2000) & 0xFFFF] = val;
-               return;
+               addr = (addr + ram_bank * 0x2000) & 0xFFFF;
             }
-            banked_ram[addr] = val;
+            banked_ram[addr]              = val;
+            page_gen[0x100 + (addr >> 8)] = write_gen;
          }
          return;
       case 0xC000: // Work RAM
       case 0xD000:
-         ram[addr] = val;
+         ram[addr]           = val;
+         page_gen[addr >> 8] = write_gen;
          return;
       case 0xE000: // 0xC000 mirror
-         ram[addr - 0x2000] = val;
+         ram[addr - 0x2000]             = val;
+         page_gen[(addr - 0x2000) >> 8] = write_gen;
          return;
       case 0xF000:
          if (addr < 0xFE00) { // Partial 0xD000 mirror
-            ram[addr - 0x2000] = val;
+            ram[addr - 0x2000]             = val;
+            page_gen[(addr - 0x2000) >> 8] = write_gen;
             return;
          }
          if (addr < 0xFEA0) { // FE00 to FE9F is OAM
@@ -435,7 +654,9 @@ void wbyte(word addr, byte val) {
             // and not during an OAM DMA transfer
             if (lcd_oam_accessible()) {
                if (dma == INACTIVE || dma == STARTING) {
-                  ram[addr] = val;
+                  ram[addr]           = val;
+                  page_gen[addr >> 8] = write_gen;
+                  video_gen++;
                }
             }
             return;
@@ -457,7 +678,7 @@ void wbyte(word addr, byte val) {
          // TIMA and DIV use the same internal counter,
          // so resetting DIV also resets TIMA
          cpu_reset_timer();
-         ram[DIV] = 0;
+         dwrite(DIV, 0);
          return;
       case DMA:
          start_dma(val);
@@ -465,6 +686,13 @@ void wbyte(word addr, byte val) {
       case JOYP:
          joy_last_write = val & 0x30;
          return;
+      case SC:
+         // Nothing is plugged into the link cable, but Blargg's test
+         // ROMs print their results over it
+         if (val & 0x80) {
+            serial_send(dread(SB));
+         }
+         break;
 
       // LCD HW Registers
       case LCDC:
@@ -504,11 +732,19 @@ void wbyte(word addr, byte val) {
    }
 
    // 0xFF00 to 0xFFFF
-   ram[addr] = val;
+   ram[addr]           = val;
+   page_gen[addr >> 8] = write_gen;
 }
 
 // Read byte
 byte rbyte(word addr) {
+   TIMING_BEGIN(ZONE_MEMORY);
+   byte val = read_bus(addr);
+   TIMING_END();
+   return val;
+}
+
+byte read_bus(word addr) {
    dbg_notify_read(addr);
 
    switch (addr & 0xF000) {
@@ -17,10 +17,38 @@ void press_dpad(dpad dir);
 void release_button(button but);
 void release_dpad(dpad dir);
 
+// Held buttons in the low nibble and directions in the high one
+byte joypad_held();
+
+// Cartridge RAM, MBC and DMA registers, and everything mapped from
+// 0x8000 up, which takes in the APU's registers. The ROM itself isn't
+// saved, only its header, so a snapshot can't be loaded into a
+// different game. Part of the save state format, so the layout is
+// fixed.
+typedef struct mem_snapshot_ {
+   byte ram[0x8000];
+   byte banked_ram[0x10000];
+   byte header[0x50];
+   word dma_src;
+   word dma_dst;
+   word dma_rst;
+   byte dma;
+   byte banking;
+   byte ram_locked;
+   byte rom_bank;
+   byte ram_bank;
+   byte joy_dpad;
+   byte joy_buttons;
+   byte joy_last_write;
+   byte unused[2];
+   char serial_tail[8]; // For spotting a test ROM's result
+} mem_snapshot;
+
 void mem_init();
 void mem_free();
 void mem_advance_time(cycle ticks);
 void mem_load_image(char* fname);
+bool mem_load_rom(const byte* data, size_t size);
 void mem_print_rom_info();
 void wbyte(word addr, byte val);
 void wword(word addr, word val);
@@ -32,5 +60,29 @@ word rword(word addr);
 // registers that reset on write, etc).
 void dwrite(word addr, byte val);
 byte dread(word addr);
+byte* mem_ptr(word addr);
+
+// Changes whenever VRAM or OAM is written
+uint32_t mem_video_generation();
+
+byte mem_rom_bank();
+
+void mem_save_state(mem_snapshot* s);
+bool mem_load_state(const mem_snapshot* s);
+
+// The 256 byte pages of a snapshot's ram and banked_ram, in order
+#define MEM_SNAPSHOT_PAGES ((0x8000 + 0x10000) / 0x100)
+
+// Every write to RAM stamps its page with a generation, and this
+// starts a new one. It brings s up to date, copying only the pages
+// written in generation since or later, and returns the generation
+// to pass next time. s must hold the state from the call that
+// returned since, and 0 copies everything. If changed isn't NULL,
+// it gets a flag for each snapshot page saying if it was copied.
+uint32_t mem_update_state(mem_snapshot* s, uint32_t since, bool* changed);
+
+// Goes back to a snapshot from mem_update_state, copying back only
+// the pages written since the generation it returned
+void mem_restore_state(const mem_snapshot* s, uint32_t since);
 
 #endif
@@ -0,0 +1,331 @@
+#include "cpu.h"
+#include "gb.h"
+#include "input.h"
+#include "lcd.h"
+#include "memory.h"
+#include "pacing.h"
+
+#include <string.h>
+
+// Times the functions the core spends most of its time in, one at a
+// time, on synthetic workloads. Every number is the time for one
+// call, taken from repeated runs after a warmup.
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define WARMUP_RUNS 3
+#define TIMED_RUNS 15
+#define ROM_SIZE 0x10000 // MBC1 with 4 banks
+#define CODE_START 0x0150
+
+typedef void (*bench_fn)(int count);
+
+// ------------------
+// Internal variables
+// ------------------
+
+byte rom_image[ROM_SIZE];
+word bench_addr;    // Address the memory benchmarks use
+word bench_mask;    // How far past bench_addr they go
+cycle bench_dt;     // Time step for the advance_time benchmarks
+volatile byte sink; // Keeps reads from being optimized out
+gb_state bench_state;
+
+// Instruction mixes, each an endless loop starting at CODE_START
+const byte mix_alu[] = {
+   0x04,       // INC B
+   0x80,       // ADD A, B
+   0xA9,       // XOR C
+   0x15,       // DEC D
+   0x5F,       // LD E, A
+   0xE6, 0x0F, // AND 0x0F
+   0xB3,       // OR E
+   0x18, 0xF6  // JR -10
+};
+const byte mix_memory[] = {
+   0x21, 0x00, 0xC0, // LD HL, 0xC000
+   0x22,             // LD (HL+), A
+   0x7E,             // LD A, (HL)
+   0x46,             // LD B, (HL)
+   0x3C,             // INC A
+   0x70,             // LD (HL), B
+   0xCB, 0xAC,       // RES 5, H (stay in 0xC000 - 0xDFFF)
+   0x18, 0xF7        // JR -9
+};
+const byte mix_calls[] = {
+   0xCD, 0x55, 0x01, // CALL 0x0155
+   0x18, 0xFB,       // JR -5
+   0xC5,             // PUSH BC
+   0xC1,             // POP BC
+   0xC9              // RET
+};
+const byte mix_cb[] = {
+   0xCB, 0x00, // RLC B
+   0xCB, 0x37, // SWAP A
+   0xCB, 0x7C, // BIT 7, H
+   0xCB, 0xD9, // SET 3, C
+   0xCB, 0x3A, // SRL D
+   0x18, 0xF4  // JR -12
+};
+
+// ------------------
+// Internal functions
+// ------------------
+
+void load_program(const byte* code, int len);
+void setup_video();
+void measure(const char* name, bench_fn fn, int count);
+int compare_ns(const void* a, const void* b);
+void run_rbyte(int count);
+void run_wbyte(int count);
+void run_step(int count);
+void run_scanline(int count);
+void run_cpu_advance(int count);
+void run_mem_advance(int count);
+void run_dma(int count);
+void run_init(int count);
+void run_reset(int count);
+void run_save_state(int count);
+void run_load_state(int count);
+
+// --------------------
+// Function definitions
+// --------------------
+
+// Starts the core on a blank MBC1 cartridge with the given code
+void load_program(const byte* code, int len) {
+   memset(rom_image, 0, ROM_SIZE);
+   rom_image[0x0100]   = 0xC3; // JP CODE_START
+   rom_image[0x0101]   = CODE_START & 0xFF;
+   rom_image[0x0102]   = CODE_START >> 8;
+   rom_image[CARTTYPE] = 0x01; // MBC1
+   rom_image[ROMSIZE]  = 0x01; // 4 banks
+   memcpy(rom_image + CODE_START, code, len);
+
+   mem_init();
+   mem_load_rom(rom_image, ROM_SIZE);
+   cpu_init();
+   lcd_reset();
+   input_reset();
+   lcd_set_frame_skip(0);
+}
+
+// Fills VRAM and OAM so every part of draw_scanline has work to do:
+// background, window and ten sprites on each line.
+void setup_video() {
+   for (int i = 0; i < 0x1800; ++i) {
+      dwrite(0x8000 + i, (i * 37) ^ (i >> 3));
+   }
+   for (int i = 0; i < 0x800; ++i) {
+      dwrite(0x9800 + i, i * 7);
+   }
+   for (int i = 0; i < 40; ++i) {
+      dwrite(OAMSTART + i * 4, 16 + (i / 10) * 36);    // Y
+      dwrite(OAMSTART + i * 4 + 1, 8 + (i % 10) * 16); // X
+      dwrite(OAMSTART + i * 4 + 2, i);                 // Tile
+      dwrite(OAMSTART + i * 4 + 3, (i & 3) << 5);      // Flags
+   }
+   dwrite(LCDC, 0xF3); // Everything on, window at 0x9C00
+   dwrite(SCX, 3);
+   dwrite(SCY, 5);
+   dwrite(WINY, 72);
+   dwrite(WINX, 87);
+   dwrite(BGPAL, 0xE4);
+   dwrite(OBJPAL, 0xD2);
+   dwrite(OBJPAL + 1, 0x1B);
+}
+
+int compare_ns(const void* a, const void* b) {
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+// Runs fn(count) a few times to warm up, then times it repeatedly
+// and prints the min, median and max time per call
+void measure(const char* name, bench_fn fn, int count) {
+   double runs[TIMED_RUNS];
+   for (int i = 0; i < WARMUP_RUNS; ++i) {
+      fn(count);
+   }
+   for (int i = 0; i < TIMED_RUNS; ++i) {
+      int64_t start = pacing_now();
+      fn(count);
+      runs[i] = (double)(pacing_now() - start) / count;
+   }
+   qsort(runs, TIMED_RUNS, sizeof(double), compare_ns);
+   printf("%-36s %9.2f %9.2f %9.2f\n",
+         name,
+         runs[0],
+         runs[TIMED_RUNS / 2],
+         runs[TIMED_RUNS - 1]);
+}
+
+void run_rbyte(int count) {
+   byte acc = 0;
+   for (int i = 0; i < count; ++i) {
+      acc ^= rbyte(bench_addr + (i & bench_mask));
+   }
+   sink = acc;
+}
+
+void run_wbyte(int count) {
+   for (int i = 0; i < count; ++i) {
+      wbyte(bench_addr + (i & bench_mask), i | 1);
+   }
+}
+
+void run_step(int count) {
+   for (int i = 0; i < count; ++i) {
+      cpu_execute_step();
+   }
+}
+
+void run_scanline(int count) {
+   for (int i = 0; i < count; ++i) {
+      lcd_draw_line(i % 144);
+   }
+}
+
+void run_cpu_advance(int count) {
+   for (int i = 0; i < count; ++i) {
+      cpu_advance_time(bench_dt);
+   }
+}
+
+void run_mem_advance(int count) {
+   for (int i = 0; i < count; ++i) {
+      mem_advance_time(4);
+   }
+}
+
+// Each DMA takes 161 machine cycles including the startup delay
+void run_dma(int count) {
+   for (int i = 0; i < count; ++i) {
+      if (i % 161 == 0) {
+         wbyte(DMA, 0xC0);
+      }
+      mem_advance_time(4);
+   }
+}
+
+void run_init(int count) {
+   for (int i = 0; i < count; ++i) {
+      gb_init_rom(rom_image, ROM_SIZE);
+   }
+}
+
+void run_reset(int count) {
+   for (int i = 0; i < count; ++i) {
+      gb_reset();
+   }
+}
+
+void run_save_state(int count) {
+   for (int i = 0; i < count; ++i) {
+      gb_save_state(&bench_state);
+   }
+}
+
+// A frame's worth of work writes a few pages between updates
+void run_update_state(int count) {
+   uint32_t since = gb_update_state(&bench_state, 0, NULL);
+   for (int i = 0; i < count; ++i) {
+      for (word addr = 0xC000; addr < 0xC400; addr += 0x40) {
+         wbyte(addr, i);
+      }
+      since = gb_update_state(&bench_state, since, NULL);
+   }
+}
+
+void run_load_state(int count) {
+   for (int i = 0; i < count; ++i) {
+      gb_load_state(&bench_state);
+   }
+}
+
+int main(int argc, char* args[]) {
+   int scale = argc > 1 ? atoi(args[1]) : 1;
+   if (scale < 1) {
+      printf("USAGE: %s [scale]\n", args[0]);
+      return 1;
+   }
+   int n = 100000 * scale;
+
+   printf("%-36s %9s %9s %9s\n", "ns per call", "min", "median", "max");
+
+   const struct {
+      const char* name;
+      word addr;
+   } reads[] = {
+      {"rbyte ROM bank 0", 0x0000},
+      {"rbyte ROM bank n", 0x4000},
+      {"rbyte VRAM", 0x8000},
+      {"rbyte WRAM", 0xC000},
+      {"rbyte OAM", OAMSTART},
+      {"rbyte IO (LY)", LY},
+      {"rbyte HRAM", 0xFF80},
+   }, writes[] = {
+      {"wbyte MBC bank select", 0x2000},
+      {"wbyte VRAM", 0x8000},
+      {"wbyte WRAM", 0xC000},
+      {"wbyte OAM", OAMSTART},
+      {"wbyte IO (SCX)", SCX},
+      {"wbyte HRAM", 0xFF80},
+   };
+   char name[64];
+
+   // The LCD is left where reset puts it, so VRAM and OAM take
+   // the same access checks they would mid-frame. Every IO register
+   // does something different, so those stay on one address.
+   load_program(mix_alu, sizeof(mix_alu));
+   for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); ++i) {
+      bench_addr = reads[i].addr;
+      bench_mask = bench_addr == LY ? 0 : 0xF;
+      measure(reads[i].name, run_rbyte, n);
+   }
+   for (size_t i = 0; i < sizeof(writes) / sizeof(writes[0]); ++i) {
+      bench_addr = writes[i].addr;
+      bench_mask = bench_addr == SCX ? 0 : 0xF;
+      measure(writes[i].name, run_wbyte, n);
+   }
+
+   load_program(mix_alu, sizeof(mix_alu));
+   measure("cpu_execute_step ALU mix", run_step, n);
+   load_program(mix_memory, sizeof(mix_memory));
+   measure("cpu_execute_step memory mix", run_step, n);
+   load_program(mix_calls, sizeof(mix_calls));
+   measure("cpu_execute_step CALL/RET mix", run_step, n);
+   load_program(mix_cb, sizeof(mix_cb));
+   measure("cpu_execute_step CB mix", run_step, n);
+
+   load_program(mix_alu, sizeof(mix_alu));
+   setup_video();
+   measure("draw_scanline BG + window + sprites", run_scanline, n / 10);
+   dwrite(LCDC, 0x91); // Background only
+   measure("draw_scanline BG only", run_scanline, n / 10);
+
+   const cycle dts[] = {4, 8, 12, 16, 24};
+   for (int i = 0; i < 5; ++i) {
+      load_program(mix_alu, sizeof(mix_alu));
+      bench_dt = dts[i];
+      snprintf(name, sizeof(name), "cpu_advance_time dt=%d", (int)dts[i]);
+      measure(name, run_cpu_advance, n);
+   }
+
+   load_program(mix_alu, sizeof(mix_alu));
+   measure("mem_advance_time idle", run_mem_advance, n);
+   measure("mem_advance_time during DMA", run_dma, n);
+
+   // Starting a new episode on the same ROM
+   measure("gb_init_rom", run_init, n / 100);
+   measure("gb_reset", run_reset, n / 100);
+   measure("gb_save_state", run_save_state, n / 100);
+   measure("gb_load_state", run_load_state, n / 100);
+   measure("gb_update_state, 4 pages", run_update_state, n / 10);
+
+   gb_free();
+   return 0;
+}
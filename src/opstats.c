@@ -0,0 +1,85 @@
+#include "opstats.h"
+
+#include <string.h>
+
+// ------------------
+// Internal variables
+// ------------------
+
+op_stat op_stats[OPSTATS_COUNT];
+
+// ------------------
+// Internal functions
+// ------------------
+
+int compare_op_counts(const void* a, const void* b);
+
+// --------------------
+// Function definitions
+// --------------------
+
+void opstats_reset() {
+   memset(op_stats, 0, sizeof(op_stats));
+   for (int i = 0; i < OPSTATS_COUNT; ++i) {
+      op_stats[i].op = i;
+   }
+}
+
+// Busiest first
+int compare_op_counts(const void* a, const void* b) {
+   int64_t x = ((const op_stat*)a)->count;
+   int64_t y = ((const op_stat*)b)->count;
+   return (x < y) - (x > y);
+}
+
+// Copies the opcodes that ran into out, which needs room for
+// OPSTATS_COUNT entries, busiest first. Returns how many there are.
+int opstats_sorted(op_stat* out) {
+   int count = 0;
+   for (int i = 0; i < OPSTATS_COUNT; ++i) {
+      if (op_stats[i].count > 0) {
+         out[count++] = op_stats[i];
+      }
+   }
+   qsort(out, count, sizeof(op_stat), compare_op_counts);
+   return count;
+}
+
+void opstats_print(FILE* out) {
+#ifdef OPCODE_STATS
+   op_stat sorted[OPSTATS_COUNT];
+   int count = opstats_sorted(sorted);
+
+   int64_t total_count  = 0;
+   int64_t total_cycles = 0;
+   for (int i = 0; i < count; ++i) {
+      total_count += sorted[i].count;
+      total_cycles += sorted[i].cycles;
+   }
+   if (total_count == 0) {
+      return;
+   }
+
+   fprintf(out,
+         "Opcode   Count           %%       Cycles          %%     Avg\n");
+   for (int i = 0; i < count; ++i) {
+      const op_stat* s = &sorted[i];
+      if (s->op >= 0x100) {
+         fprintf(out, "CB %02X", s->op & 0xFF);
+      } else {
+         fprintf(out, "   %02X", s->op);
+      }
+      fprintf(out,
+            "  %14" PRId64 " %6.2f %14" PRId64 " %6.2f %6.1f\n",
+            s->count,
+            100.0 * s->count / total_count,
+            s->cycles,
+            100.0 * s->cycles / total_cycles,
+            (double)s->cycles / s->count);
+   }
+   fprintf(out,
+         "Total  %14" PRId64 "        %14" PRId64 "\n",
+         total_count,
+         total_cycles);
+#endif
+}
@@ -0,0 +1,24 @@
+#ifndef __OPSTATS_H__
+#define __OPSTATS_H__
+
+#include "defines.h"
+
+// Counts how often each opcode runs and how many cycles it takes.
+// Only collected when built with OPCODE_STATS, so normal builds pay
+// nothing for it. CB xx opcodes are counted separately as 0x1xx.
+
+#define OPSTATS_COUNT 0x200
+
+typedef struct op_stat_ {
+   word op;
+   int64_t count;
+   int64_t cycles; // T-cycles, including memory access time
+} op_stat;
+
+extern op_stat op_stats[OPSTATS_COUNT];
+
+void opstats_reset();
+int opstats_sorted(op_stat* out);
+void opstats_print(FILE* out);
+
+#endif
@@ -0,0 +1,144 @@
+// clock_nanosleep needs POSIX, which -std=c11 hides
+#define _POSIX_C_SOURCE 200809L
+
+#include "pacing.h"
+
+#include <time.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define NS_PER_SECOND 1000000000LL
+
+// Sleep until this long before a deadline, then spin. Sleeping
+// all the way tends to overshoot by the scheduler's granularity.
+#define SPIN_NS 200000
+
+// If we fall this far behind (debugger, slow host), start a new
+// schedule instead of running fast to catch up.
+#define MAX_LAG_NS (NS_PER_SECOND / 10)
+
+// Number of frame times kept for the percentile report
+#define SAMPLE_COUNT 0x10000
+
+// ------------------
+// Internal variables
+// ------------------
+
+int64_t start_ns;     // Host time the schedule started
+int64_t target;       // Emulated cycles since start_ns
+int64_t last_frame;   // Host time the last wait returned, or 0
+int64_t samples[SAMPLE_COUNT];
+int64_t sample_total; // Number of frame times ever recorded
+int64_t late_frames;
+
+// ------------------
+// Internal functions
+// ------------------
+
+int64_t cycles_to_ns(int64_t cycles);
+void sleep_until(int64_t ns);
+int compare_samples(const void* a, const void* b);
+
+// --------------------
+// Function definitions
+// --------------------
+
+int64_t pacing_now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+// Split into whole seconds so large cycle counts can't overflow
+int64_t cycles_to_ns(int64_t cycles) {
+   int64_t secs = cycles / CYCLES_PER_SECOND;
+   int64_t rem  = cycles % CYCLES_PER_SECOND;
+   return secs * NS_PER_SECOND + rem * NS_PER_SECOND / CYCLES_PER_SECOND;
+}
+
+void sleep_until(int64_t ns) {
+   struct timespec ts;
+   ts.tv_sec  = ns / NS_PER_SECOND;
+   ts.tv_nsec = ns % NS_PER_SECOND;
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+      // Interrupted by a signal, go back to sleep
+   }
+}
+
+// Starts a new schedule from now. Call after running unpaced.
+void pacing_reset() {
+   start_ns   = pacing_now();
+   target     = 0;
+   last_frame = 0;
+}
+
+// Waits until the host has caught up to cycles more of emulation
+void pacing_wait(cycle cycles) {
+   if (start_ns == 0) {
+      pacing_reset();
+   }
+   target += cycles;
+   int64_t deadline = start_ns + cycles_to_ns(target);
+   int64_t now      = pacing_now();
+
+   if (now - deadline > MAX_LAG_NS) {
+      late_frames++;
+      pacing_reset();
+      now = start_ns;
+   } else {
+      if (deadline - now > SPIN_NS) {
+         sleep_until(deadline - SPIN_NS);
+      }
+      do {
+         now = pacing_now();
+      } while (now < deadline);
+   }
+
+   if (last_frame != 0) {
+      samples[sample_total++ % SAMPLE_COUNT] = now - last_frame;
+   }
+   last_frame = now;
+}
+
+void pacing_wait_frame() {
+   pacing_wait(CYCLES_PER_FRAME);
+}
+
+int compare_samples(const void* a, const void* b) {
+   int64_t x = *(const int64_t*)a;
+   int64_t y = *(const int64_t*)b;
+   return (x > y) - (x < y);
+}
+
+// Prints percentiles of the time between paced frames
+void pacing_report(FILE* out) {
+   int64_t count = sample_total < SAMPLE_COUNT ? sample_total : SAMPLE_COUNT;
+   if (count == 0) {
+      return;
+   }
+   qsort(samples, count, sizeof(int64_t), compare_samples);
+
+   double total = 0;
+   for (int64_t i = 0; i < count; ++i) {
+      total += samples[i];
+   }
+   const int pct[] = {50, 90, 99};
+   fprintf(out, "Frame times over %" PRId64 " frames:\n", count);
+   fprintf(out,
+         "  mean  %8.3f ms (%.3f fps)\n",
+         total / count / 1e6,
+         count * 1e9 / total);
+   for (int i = 0; i < 3; ++i) {
+      fprintf(out,
+            "  p%-3d  %8.3f ms\n",
+            pct[i],
+            samples[(count - 1) * pct[i] / 100] / 1e6);
+   }
+   fprintf(out, "  max   %8.3f ms\n", samples[count - 1] / 1e6);
+   fprintf(out, "  target %7.3f ms\n", cycles_to_ns(CYCLES_PER_FRAME) / 1e6);
+   if (late_frames > 0) {
+      fprintf(out, "  fell behind %" PRId64 " times\n", late_frames);
+   }
+}
@@ -0,0 +1,16 @@
+#ifndef __PACING_H__
+#define __PACING_H__
+
+#include "defines.h"
+
+// Keeps emulation in step with real time using the monotonic clock.
+// Deadlines are kept in emulated cycles, so rounding never adds up
+// and the average rate is exactly one frame per 70224 cycles.
+
+void pacing_reset();
+void pacing_wait(cycle cycles);
+void pacing_wait_frame();
+void pacing_report(FILE* out);
+int64_t pacing_now();
+
+#endif
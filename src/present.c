@@ -0,0 +1,207 @@
+#include "present.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define SRC_W 160
+#define SRC_H 144
+
+// ------------------
+// Internal variables
+// ------------------
+
+// Holds the first Scale2x pass when using EPX at 4x
+uint32_t epx_temp[SRC_W * 2 * SRC_H * 2];
+
+// ------------------
+// Internal functions
+// ------------------
+
+void widen_row(const uint32_t* src, uint32_t* dst, int width, int scale);
+void scale_nearest(const uint32_t* src,
+      int width,
+      int height,
+      byte* dst,
+      int pitch,
+      int scale);
+void scale2x(const uint32_t* src, int width, int height, byte* dst, int pitch);
+void scale3x(const uint32_t* src, int width, int height, byte* dst, int pitch);
+
+// --------------------
+// Function definitions
+// --------------------
+
+const char* present_filter_name(present_filter filter) {
+   switch (filter) {
+      case PRESENT_NEAREST:
+         return "nearest";
+      case PRESENT_EPX:
+         return "epx";
+      default:
+         break;
+   }
+   return "unknown";
+}
+
+void present_frame(const uint32_t* src,
+      byte* dst,
+      int pitch,
+      int scale,
+      present_filter filter) {
+   if (filter == PRESENT_EPX && scale > 1) {
+      switch (scale) {
+         case 2:
+            scale2x(src, SRC_W, SRC_H, dst, pitch);
+            return;
+         case 3:
+            scale3x(src, SRC_W, SRC_H, dst, pitch);
+            return;
+         case 4:
+            // Scale4x is Scale2x applied twice
+            scale2x(src, SRC_W, SRC_H, (byte*)epx_temp, SRC_W * 2 * 4);
+            scale2x(epx_temp, SRC_W * 2, SRC_H * 2, dst, pitch);
+            return;
+         default:
+            break;
+      }
+   }
+   scale_nearest(src, SRC_W, SRC_H, dst, pitch, scale);
+}
+
+// Repeats every pixel in a row scale times. Width must be
+// a multiple of 4.
+void widen_row(const uint32_t* src, uint32_t* dst, int width, int scale) {
+#ifdef __SSE2__
+   const __m128i* in = (const __m128i*)src;
+   __m128i* out      = (__m128i*)dst;
+   switch (scale) {
+      case 2:
+         for (int x = 0; x < width / 4; ++x) {
+            __m128i p = _mm_loadu_si128(in + x);
+            _mm_storeu_si128(out++, _mm_unpacklo_epi32(p, p));
+            _mm_storeu_si128(out++, _mm_unpackhi_epi32(p, p));
+         }
+         return;
+      case 3:
+         for (int x = 0; x < width / 4; ++x) {
+            __m128i p = _mm_loadu_si128(in + x);
+            _mm_storeu_si128(out++, _mm_shuffle_epi32(p, 0x40)); // 0 0 0 1
+            _mm_storeu_si128(out++, _mm_shuffle_epi32(p, 0xA5)); // 1 1 2 2
+            _mm_storeu_si128(out++, _mm_shuffle_epi32(p, 0xFE)); // 2 3 3 3
+         }
+         return;
+      case 4:
+         for (int x = 0; x < width / 4; ++x) {
+            __m128i p = _mm_loadu_si128(in + x);
+            _mm_storeu_si128(out++, _mm_shuffle_epi32(p, 0x00));
+            _mm_storeu_si128(out++, _mm_shuffle_epi32(p, 0x55));
+            _mm_storeu_si128(out++, _mm_shuffle_epi32(p, 0xAA));
+            _mm_storeu_si128(out++, _mm_shuffle_epi32(p, 0xFF));
+         }
+         return;
+      default:
+         break;
+   }
+#endif
+   for (int x = 0; x < width; ++x) {
+      for (int s = 0; s < scale; ++s) {
+         *dst++ = src[x];
+      }
+   }
+}
+
+// Each source row is widened once, then copied for the rest
+// of the rows it covers.
+void scale_nearest(const uint32_t* src,
+      int width,
+      int height,
+      byte* dst,
+      int pitch,
+      int scale) {
+   int row_bytes = width * scale * sizeof(uint32_t);
+   for (int y = 0; y < height; ++y) {
+      byte* row = dst + y * scale * pitch;
+      widen_row(src + y * width, (uint32_t*)row, width, scale);
+      for (int s = 1; s < scale; ++s) {
+         memcpy(row + s * pitch, row, row_bytes);
+      }
+   }
+}
+
+// Scale2x, which gives the same result as EPX. Neighbors past
+// the edge of the image repeat the edge pixel.
+//    B         E0 E1
+//  D E F  ->   E2 E3
+//    H
+void scale2x(const uint32_t* src, int width, int height, byte* dst, int pitch) {
+   for (int y = 0; y < height; ++y) {
+      const uint32_t* up   = src + (y > 0 ? y - 1 : y) * width;
+      const uint32_t* mid  = src + y * width;
+      const uint32_t* down = src + (y < height - 1 ? y + 1 : y) * width;
+      uint32_t* out0       = (uint32_t*)(dst + y * 2 * pitch);
+      uint32_t* out1       = (uint32_t*)(dst + (y * 2 + 1) * pitch);
+      for (int x = 0; x < width; ++x) {
+         uint32_t b = up[x];
+         uint32_t d = mid[x > 0 ? x - 1 : x];
+         uint32_t e = mid[x];
+         uint32_t f = mid[x < width - 1 ? x + 1 : x];
+         uint32_t h = down[x];
+         if (b != h && d != f) {
+            out0[x * 2]     = d == b ? d : e;
+            out0[x * 2 + 1] = b == f ? f : e;
+            out1[x * 2]     = d == h ? d : e;
+            out1[x * 2 + 1] = h == f ? f : e;
+         } else {
+            out0[x * 2] = out0[x * 2 + 1] = e;
+            out1[x * 2] = out1[x * 2 + 1] = e;
+         }
+      }
+   }
+}
+
+// Scale3x, the 3x version of the same rules
+//  A B C       E0 E1 E2
+//  D E F  ->   E3 E4 E5
+//  G H I       E6 E7 E8
+void scale3x(const uint32_t* src, int width, int height, byte* dst, int pitch) {
+   for (int y = 0; y < height; ++y) {
+      const uint32_t* up   = src + (y > 0 ? y - 1 : y) * width;
+      const uint32_t* mid  = src + y * width;
+      const uint32_t* down = src + (y < height - 1 ? y + 1 : y) * width;
+      uint32_t* out0       = (uint32_t*)(dst + y * 3 * pitch);
+      uint32_t* out1       = (uint32_t*)(dst + (y * 3 + 1) * pitch);
+      uint32_t* out2       = (uint32_t*)(dst + (y * 3 + 2) * pitch);
+      for (int x = 0; x < width; ++x) {
+         int l      = x > 0 ? x - 1 : x;
+         int r      = x < width - 1 ? x + 1 : x;
+         uint32_t a = up[l], b = up[x], c = up[r];
+         uint32_t d = mid[l], e = mid[x], f = mid[r];
+         uint32_t g = down[l], h = down[x], i = down[r];
+         uint32_t* o0 = out0 + x * 3;
+         uint32_t* o1 = out1 + x * 3;
+         uint32_t* o2 = out2 + x * 3;
+         if (b != h && d != f) {
+            o0[0] = d == b ? d : e;
+            o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+            o0[2] = b == f ? f : e;
+            o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+            o1[1] = e;
+            o1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+            o2[0] = d == h ? d : e;
+            o2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+            o2[2] = h == f ? f : e;
+         } else {
+            o0[0] = o0[1] = o0[2] = e;
+            o1[0] = o1[1] = o1[2] = e;
+            o2[0] = o2[1] = o2[2] = e;
+         }
+      }
+   }
+}
@@ -0,0 +1,24 @@
+#ifndef __PRESENT_H__
+#define __PRESENT_H__
+
+#include "defines.h"
+
+// Scales the 160x144 XRGB8888 output of the LCD up for display.
+// Doesn't depend on SDL, so any frontend can use it.
+
+typedef enum present_filter_ {
+   PRESENT_NEAREST, // Plain pixel doubling / tripling / quadrupling
+   PRESENT_EPX,     // Scale2x (EPX), Scale3x, or Scale2x twice at 4x
+   PRESENT_FILTER_COUNT
+} present_filter;
+
+// Scale must be from 1 to 4. dst must have room for
+// 144 * scale rows of 160 * scale pixels, pitch bytes apart.
+void present_frame(const uint32_t* src,
+      byte* dst,
+      int pitch,
+      int scale,
+      present_filter filter);
+const char* present_filter_name(present_filter filter);
+
+#endif
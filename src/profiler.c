@@ -0,0 +1,298 @@
+#include "profiler.h"
+#include "memory.h"
+
+#include <string.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define MAX_NODES 0x10000
+#define MAX_DEPTH 64
+#define ROOT 0
+#define KEY_IRQ 0x1000000 // Set on frames entered by an interrupt
+#define UNBANKED 256      // pc_cycles slot covering all 64kb
+
+// A routine, as reached through one particular chain of calls
+typedef struct call_node_ {
+   uint32_t key; // Bank << 16 | address, plus KEY_IRQ
+   int parent;
+   int child;
+   int sibling;
+   int64_t self; // Cycles spent in this routine itself
+   int64_t calls;
+} call_node;
+
+typedef struct call_frame_ {
+   int node;
+   word sp; // Where the return address was pushed
+} call_frame;
+
+// Totals for one routine or instruction in the flat profile
+typedef struct profile_entry_ {
+   uint32_t key;
+   int64_t self;
+   int64_t total;
+   int64_t calls;
+} profile_entry;
+
+// ------------------
+// Internal variables
+// ------------------
+
+call_node nodes[MAX_NODES];
+int node_count;
+call_frame stack[MAX_DEPTH];
+int depth;
+int64_t* pc_cycles[UNBANKED + 1]; // Allocated on first use
+int64_t total_cycles;
+int64_t halted_cycles;
+int64_t dropped_calls; // Calls too deep, or once the tree was full
+
+// ------------------
+// Internal functions
+// ------------------
+
+uint32_t code_key(word pc);
+void key_label(uint32_t key, char* buf, int len);
+int compare_entry_keys(const void* a, const void* b);
+int compare_entry_self(const void* a, const void* b);
+bool has_ancestor(int node, uint32_t key);
+
+// --------------------
+// Function definitions
+// --------------------
+
+void profiler_reset() {
+   profiler_free();
+   memset(&nodes[ROOT], 0, sizeof(call_node));
+   nodes[ROOT].child   = -1;
+   nodes[ROOT].sibling = -1;
+   node_count          = 1;
+   depth               = 0;
+   stack[0].node       = ROOT;
+   total_cycles        = 0;
+   halted_cycles       = 0;
+   dropped_calls       = 0;
+}
+
+void profiler_free() {
+   for (int i = 0; i <= UNBANKED; ++i) {
+      free(pc_cycles[i]);
+      pc_cycles[i] = NULL;
+   }
+}
+
+uint32_t code_key(word pc) {
+   if (pc >= 0x4000 && pc < 0x8000) {
+      return (uint32_t)mem_rom_bank() << 16 | pc;
+   }
+   return pc;
+}
+
+void profiler_cycles(word pc, cycle cycles, bool halted) {
+   int slot  = UNBANKED;
+   int index = pc;
+   if (pc >= 0x4000 && pc < 0x8000) {
+      slot  = mem_rom_bank();
+      index = pc - 0x4000;
+   }
+   if (pc_cycles[slot] == NULL) {
+      pc_cycles[slot] =
+            calloc(slot == UNBANKED ? 0x10000 : 0x4000, sizeof(int64_t));
+   }
+   pc_cycles[slot][index] += cycles;
+   nodes[stack[depth].node].self += cycles;
+   total_cycles += cycles;
+   if (halted) {
+      halted_cycles += cycles;
+   }
+}
+
+void profiler_call(word target, word sp, bool interrupt) {
+   if (depth + 1 >= MAX_DEPTH) {
+      dropped_calls++;
+      return;
+   }
+   uint32_t key = code_key(target) | (interrupt ? KEY_IRQ : 0);
+   int parent   = stack[depth].node;
+   int node     = nodes[parent].child;
+   while (node >= 0 && nodes[node].key != key) {
+      node = nodes[node].sibling;
+   }
+   if (node < 0) {
+      if (node_count == MAX_NODES) {
+         dropped_calls++;
+         return;
+      }
+      node                = node_count++;
+      nodes[node].key     = key;
+      nodes[node].parent  = parent;
+      nodes[node].child   = -1;
+      nodes[node].sibling = nodes[parent].child;
+      nodes[node].self    = 0;
+      nodes[node].calls   = 0;
+      nodes[parent].child = node;
+   }
+   nodes[node].calls++;
+   depth++;
+   stack[depth].node = node;
+   stack[depth].sp   = sp;
+}
+
+// Unwinds every frame whose return address is at or below sp. Code
+// that drops its return address and jumps away is unwound by the
+// next return from further up the stack.
+void profiler_ret(word sp) {
+   while (depth > 0 && stack[depth].sp <= sp) {
+      depth--;
+   }
+}
+
+void key_label(uint32_t key, char* buf, int len) {
+   if (key & KEY_IRQ) {
+      snprintf(buf, len, "irq_%04X", key & 0xFFFF);
+   } else {
+      snprintf(buf, len, "%02X:%04X", (key >> 16) & 0xFF, key & 0xFFFF);
+   }
+}
+
+int compare_entry_keys(const void* a, const void* b) {
+   uint32_t x = ((const profile_entry*)a)->key;
+   uint32_t y = ((const profile_entry*)b)->key;
+   return (x > y) - (x < y);
+}
+
+// Busiest first
+int compare_entry_self(const void* a, const void* b) {
+   int64_t x = ((const profile_entry*)a)->self;
+   int64_t y = ((const profile_entry*)b)->self;
+   return (x < y) - (x > y);
+}
+
+// True if a recursive call already counted this routine's total
+bool has_ancestor(int node, uint32_t key) {
+   for (node = nodes[node].parent; node > ROOT; node = nodes[node].parent) {
+      if (nodes[node].key == key) {
+         return true;
+      }
+   }
+   return false;
+}
+
+void profiler_print_flat(FILE* out, int top) {
+   if (total_cycles == 0) {
+      return;
+   }
+   char label[16];
+
+   // Totals include callees. Children always come after their parent,
+   // so one backwards pass adds every subtree up.
+   int64_t* totals = malloc(node_count * sizeof(int64_t));
+   for (int i = 0; i < node_count; ++i) {
+      totals[i] = nodes[i].self;
+   }
+   for (int i = node_count - 1; i > ROOT; --i) {
+      totals[nodes[i].parent] += totals[i];
+   }
+
+   // Merge every path into one entry per routine
+   profile_entry* entries = malloc(node_count * sizeof(profile_entry));
+   for (int i = 0; i < node_count; ++i) {
+      entries[i].key   = i == ROOT ? 0xFFFFFFFF : nodes[i].key;
+      entries[i].self  = nodes[i].self;
+      entries[i].total = has_ancestor(i, nodes[i].key) ? 0 : totals[i];
+      entries[i].calls = nodes[i].calls;
+   }
+   qsort(entries, node_count, sizeof(profile_entry), compare_entry_keys);
+   int count = 0;
+   for (int i = 0; i < node_count; ++i) {
+      if (count > 0 && entries[count - 1].key == entries[i].key) {
+         entries[count - 1].self += entries[i].self;
+         entries[count - 1].total += entries[i].total;
+         entries[count - 1].calls += entries[i].calls;
+      } else {
+         entries[count++] = entries[i];
+      }
+   }
+   qsort(entries, count, sizeof(profile_entry), compare_entry_self);
+
+   fprintf(out,
+         "Guest profile: %" PRId64 " cycles, %.1f%% halted\n",
+         total_cycles,
+         100.0 * halted_cycles / total_cycles);
+   if (dropped_calls > 0) {
+      fprintf(out, "%" PRId64 " calls weren't tracked\n", dropped_calls);
+   }
+   fprintf(out, "\nRoutine      self %%     total %%       calls\n");
+   for (int i = 0; i < count && i < top; ++i) {
+      if (entries[i].key == 0xFFFFFFFF) {
+         snprintf(label, sizeof(label), "(top)");
+      } else {
+         key_label(entries[i].key, label, sizeof(label));
+      }
+      fprintf(out,
+            "%-10s %8.2f %10.2f %12" PRId64 "\n",
+            label,
+            100.0 * entries[i].self / total_cycles,
+            100.0 * entries[i].total / total_cycles,
+            entries[i].calls);
+   }
+   free(entries);
+   free(totals);
+
+   // Then the busiest single instructions
+   int pcs = 0;
+   for (int s = 0; s <= UNBANKED; ++s) {
+      int size = s == UNBANKED ? 0x10000 : 0x4000;
+      for (int i = 0; pc_cycles[s] != NULL && i < size; ++i) {
+         pcs += pc_cycles[s][i] > 0;
+      }
+   }
+   entries = malloc(pcs * sizeof(profile_entry));
+   count   = 0;
+   for (int s = 0; s <= UNBANKED; ++s) {
+      int size = s == UNBANKED ? 0x10000 : 0x4000;
+      for (int i = 0; pc_cycles[s] != NULL && i < size; ++i) {
+         if (pc_cycles[s][i] > 0) {
+            uint32_t key = i;
+            if (s != UNBANKED) {
+               key = (uint32_t)s << 16 | (i + 0x4000);
+            }
+            entries[count].key  = key;
+            entries[count].self = pc_cycles[s][i];
+            count++;
+         }
+      }
+   }
+   qsort(entries, count, sizeof(profile_entry), compare_entry_self);
+   fprintf(out, "\nAddress      self %%\n");
+   for (int i = 0; i < count && i < top; ++i) {
+      key_label(entries[i].key, label, sizeof(label));
+      fprintf(out,
+            "%-10s %8.2f\n",
+            label,
+            100.0 * entries[i].self / total_cycles);
+   }
+   free(entries);
+}
+
+void profiler_write_folded(FILE* out) {
+   int path[MAX_DEPTH];
+   char label[16];
+   for (int i = 0; i < node_count; ++i) {
+      if (nodes[i].self == 0) {
+         continue;
+      }
+      int len = 0;
+      for (int n = i; n > ROOT && len < MAX_DEPTH; n = nodes[n].parent) {
+         path[len++] = n;
+      }
+      fprintf(out, "(top)");
+      while (len > 0) {
+         key_label(nodes[path[--len]].key, label, sizeof(label));
+         fprintf(out, ";%s", label);
+      }
+      fprintf(out, " %" PRId64 "\n", nodes[i].self);
+   }
+}
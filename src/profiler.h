@@ -0,0 +1,23 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "defines.h"
+
+// Finds where guest code spends its cycles, by (ROM bank, PC) and
+// by call stack. The CPU only reports to it when built with
+// GUEST_PROFILE. Addresses outside 0x4000 - 0x7FFF use bank 0.
+
+void profiler_reset();
+void profiler_free();
+void profiler_cycles(word pc, cycle cycles, bool halted);
+void profiler_call(word target, word sp, bool interrupt);
+void profiler_ret(word sp);
+
+// Prints the busiest routines and instructions
+void profiler_print_flat(FILE* out, int top);
+
+// Writes one "caller;callee;... cycles" line per call stack, the
+// format flamegraph.pl and speedscope read
+void profiler_write_folded(FILE* out);
+
+#endif
@@ -0,0 +1,359 @@
+#include "rewind.h"
+#include "gb.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+// Equal bytes it takes to end a literal run. Shorter gaps cost less
+// to keep in the literal than to start a new run for.
+#define MIN_GAP 4
+
+// Room for the largest packed delta. Zero runs between literals are
+// at least MIN_GAP long, so packing can only grow a state by a few
+// length bytes, and twice its size is plenty.
+#define MAX_PACKED (sizeof(gb_state) * 2)
+
+// Where one packed delta sits in the history ring
+typedef struct rewind_delta_ {
+   size_t start;
+   size_t size;
+} rewind_delta;
+
+// A stretch of a state that may differ from the capture before. The
+// memory pages, one span each at most, and the parts around them.
+typedef struct rewind_span_ {
+   size_t start;
+   size_t size;
+} rewind_span;
+
+#define MAX_SPANS (MEM_SNAPSHOT_PAGES + 2)
+
+// ------------------
+// Internal variables
+// ------------------
+
+// Packed deltas, oldest first, wrapping around the end. Undoing
+// delta n turns capture n back into capture n - 1.
+_Thread_local byte* history;
+_Thread_local size_t history_size;
+_Thread_local size_t history_head; // Where the next delta goes
+_Thread_local size_t history_used;
+
+_Thread_local rewind_delta* deltas;
+_Thread_local int delta_max;
+_Thread_local int delta_first;
+_Thread_local int delta_count;
+
+// Between captures these are the same. The capture is brought up
+// to date incrementally, then compared with the newest.
+_Thread_local gb_state* newest;  // The last capture, or the last loaded
+_Thread_local gb_state* capture; // The state being captured
+_Thread_local uint32_t capture_gen;
+_Thread_local byte* packed; // A delta on its way in or out
+_Thread_local bool have_newest;
+
+// ------------------
+// Internal functions
+// ------------------
+
+size_t same_run(const byte* a, const byte* b, size_t n);
+size_t diff_run(const byte* a, const byte* b, size_t n);
+byte* put_length(byte* p, size_t len);
+const byte* get_length(const byte* p, size_t* len);
+int add_span(rewind_span* spans, int count, size_t start, size_t size);
+int changed_spans(const bool* changed, rewind_span* spans);
+size_t pack_delta(const byte* cur,
+      const byte* prev,
+      const rewind_span* spans,
+      int count,
+      byte* out);
+void unpack_delta(const byte* in, byte* state);
+void drop_oldest();
+void ring_write(const byte* src, size_t size);
+void ring_read(size_t start, size_t size, byte* dst);
+
+// --------------------
+// Function definitions
+// --------------------
+
+bool rewind_init(int count, size_t bytes) {
+   rewind_free();
+   if (count < 1 || bytes == 0) {
+      return true;
+   }
+   history = malloc(bytes);
+   deltas  = malloc(count * sizeof(rewind_delta));
+   newest  = malloc(sizeof(gb_state));
+   capture = malloc(sizeof(gb_state));
+   packed  = malloc(MAX_PACKED);
+   if (history == NULL || deltas == NULL || newest == NULL
+         || capture == NULL || packed == NULL) {
+      rewind_free();
+      return false;
+   }
+   history_size = bytes;
+   delta_max    = count;
+   return true;
+}
+
+void rewind_free() {
+   free(history);
+   free(deltas);
+   free(newest);
+   free(capture);
+   free(packed);
+   history      = NULL;
+   deltas       = NULL;
+   newest       = NULL;
+   capture      = NULL;
+   packed       = NULL;
+   history_size = 0;
+   delta_max    = 0;
+   rewind_clear();
+}
+
+void rewind_clear() {
+   history_head = 0;
+   history_used = 0;
+   delta_first  = 0;
+   delta_count  = 0;
+   have_newest  = false;
+}
+
+int rewind_count() {
+   return delta_count;
+}
+
+size_t rewind_bytes() {
+   return history_used;
+}
+
+// Length of the run of equal bytes a and b start with. Compares
+// eight at a time, since most of a state doesn't change.
+size_t same_run(const byte* a, const byte* b, size_t n) {
+   size_t i = 0;
+   while (i + 8 <= n) {
+      uint64_t x, y;
+      memcpy(&x, a + i, 8);
+      memcpy(&y, b + i, 8);
+      if (x != y) {
+         break;
+      }
+      i += 8;
+   }
+   while (i < n && a[i] == b[i]) {
+      i++;
+   }
+   return i;
+}
+
+// Length of the run a and b start with that differs, taking in gaps
+// shorter than MIN_GAP
+size_t diff_run(const byte* a, const byte* b, size_t n) {
+   size_t i = 0;
+   while (i < n) {
+      if (a[i] != b[i]) {
+         i++;
+         continue;
+      }
+      size_t gap = same_run(a + i, b + i, n - i);
+      if (gap >= MIN_GAP || i + gap == n) {
+         break;
+      }
+      i += gap;
+   }
+   return i;
+}
+
+// Lengths are stored 7 bits at a time, low bits first
+byte* put_length(byte* p, size_t len) {
+   while (len >= 0x80) {
+      *p++ = (len & 0x7F) | 0x80;
+      len >>= 7;
+   }
+   *p++ = len;
+   return p;
+}
+
+const byte* get_length(const byte* p, size_t* len) {
+   *len      = 0;
+   int shift = 0;
+   while (*p & 0x80) {
+      *len |= (size_t)(*p++ & 0x7F) << shift;
+      shift += 7;
+   }
+   *len |= (size_t)*p++ << shift;
+   return p;
+}
+
+// Adds a span, joining it to the last one if they touch. Returns
+// the new count.
+int add_span(rewind_span* spans, int count, size_t start, size_t size) {
+   if (count > 0 && spans[count - 1].start + spans[count - 1].size == start) {
+      spans[count - 1].size += size;
+      return count;
+   }
+   spans[count].start = start;
+   spans[count].size  = size;
+   return count + 1;
+}
+
+// Pages not written since the last capture can't differ from it, so
+// only the written ones and the registers around them need comparing
+int changed_spans(const bool* changed, rewind_span* spans) {
+   int count = add_span(spans, 0, 0, offsetof(gb_state, mem.ram));
+   for (int i = 0; i < MEM_SNAPSHOT_PAGES; ++i) {
+      if (!changed[i]) {
+         continue;
+      }
+      size_t start = i < 0x80
+            ? offsetof(gb_state, mem.ram) + i * 0x100
+            : offsetof(gb_state, mem.banked_ram) + (i - 0x80) * 0x100;
+      count = add_span(spans, count, start, 0x100);
+   }
+   size_t tail = offsetof(gb_state, mem.header);
+   return add_span(spans, count, tail, sizeof(gb_state) - tail);
+}
+
+// Packs cur XOR prev as pairs of runs: a length of zeros, then a
+// length of XOR'd bytes and the bytes themselves. Only the spans are
+// compared, and the rest counts as zeros. Returns the size.
+size_t pack_delta(const byte* cur,
+      const byte* prev,
+      const rewind_span* spans,
+      int count,
+      byte* out) {
+   byte* p      = out;
+   size_t zeros = 0;
+   size_t done  = 0; // End of the last span
+   for (int s = 0; s < count; ++s) {
+      size_t i   = spans[s].start;
+      size_t end = i + spans[s].size;
+      zeros += i - done;
+      while (i < end) {
+         size_t same = same_run(cur + i, prev + i, end - i);
+         zeros += same;
+         i += same;
+         if (i == end) {
+            break;
+         }
+         size_t len = diff_run(cur + i, prev + i, end - i);
+         p          = put_length(p, zeros);
+         p          = put_length(p, len);
+         for (size_t j = 0; j < len; ++j) {
+            p[j] = cur[i + j] ^ prev[i + j];
+         }
+         p += len;
+         i += len;
+         zeros = 0;
+      }
+      done = end;
+   }
+   zeros += sizeof(gb_state) - done;
+   if (zeros > 0) {
+      p = put_length(p, zeros);
+      p = put_length(p, 0);
+   }
+   return p - out;
+}
+
+// XORs a packed delta back into state, in place
+void unpack_delta(const byte* in, byte* state) {
+   size_t i = 0;
+   while (i < sizeof(gb_state)) {
+      size_t zeros, len;
+      in = get_length(in, &zeros);
+      in = get_length(in, &len);
+      i += zeros;
+      for (size_t j = 0; j < len; ++j) {
+         state[i + j] ^= in[j];
+      }
+      in += len;
+      i += len;
+   }
+}
+
+void drop_oldest() {
+   history_used -= deltas[delta_first].size;
+   delta_first = (delta_first + 1) % delta_max;
+   delta_count--;
+}
+
+// Copies into the ring at history_head, wrapping around the end
+void ring_write(const byte* src, size_t size) {
+   size_t first = history_size - history_head;
+   if (first > size) {
+      first = size;
+   }
+   memcpy(history + history_head, src, first);
+   memcpy(history, src + first, size - first);
+   history_head = (history_head + size) % history_size;
+   history_used += size;
+}
+
+void ring_read(size_t start, size_t size, byte* dst) {
+   size_t first = history_size - start;
+   if (first > size) {
+      first = size;
+   }
+   memcpy(dst, history + start, first);
+   memcpy(dst + first, history, size - first);
+}
+
+void rewind_capture() {
+   if (history == NULL) {
+      return;
+   }
+   if (!have_newest) {
+      capture_gen = gb_update_state(capture, 0, NULL);
+      memcpy(newest, capture, sizeof(gb_state));
+      have_newest = true;
+      return;
+   }
+   bool changed[MEM_SNAPSHOT_PAGES];
+   rewind_span spans[MAX_SPANS];
+   capture_gen = gb_update_state(capture, capture_gen, changed);
+   int count   = changed_spans(changed, spans);
+   size_t size = pack_delta(
+         (byte*)capture, (byte*)newest, spans, count, packed);
+   if (size > history_size) {
+      // Too big to keep, and the history can't skip a delta
+      rewind_clear();
+      have_newest = true;
+   } else {
+      while (delta_count == delta_max
+             || history_used + size > history_size) {
+         drop_oldest();
+      }
+      int slot           = (delta_first + delta_count) % delta_max;
+      deltas[slot].start = history_head;
+      deltas[slot].size  = size;
+      ring_write(packed, size);
+      delta_count++;
+   }
+   // Only the spans can differ, so copying them catches newest up
+   for (int i = 0; i < count; ++i) {
+      memcpy((byte*)newest + spans[i].start,
+            (byte*)capture + spans[i].start,
+            spans[i].size);
+   }
+}
+
+bool rewind_step() {
+   if (delta_count == 0) {
+      return false;
+   }
+   int slot        = (delta_first + delta_count - 1) % delta_max;
+   rewind_delta* d = &deltas[slot];
+   ring_read(d->start, d->size, packed);
+   unpack_delta(packed, (byte*)newest);
+   unpack_delta(packed, (byte*)capture);
+   history_head = d->start;
+   history_used -= d->size;
+   delta_count--;
+   return gb_load_state(newest);
+}
@@ -0,0 +1,35 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include "defines.h"
+
+// Keeps a history of save states to step back through. Each capture
+// is stored as the XOR of it and the capture before, run length
+// encoded. Between frames little changes, so the XOR is nearly all
+// zeros and packs down to a few hundred bytes. Only the newest state
+// is kept whole, and stepping back undoes one delta at a time.
+// Capturing only looks at the memory pages written since the last
+// capture, so it costs little more than the frame's writes did.
+//
+// The history is per Game Boy, like the rest of its state.
+
+// Keeps at most count captures, in at most bytes of packed deltas.
+// The oldest are dropped to make room. Clears any history there was,
+// and a count or size of 0 turns rewinding off. Returns false if
+// the memory couldn't be allocated, which also turns it off.
+bool rewind_init(int count, size_t bytes);
+void rewind_free();
+void rewind_clear();
+
+// Call once per frame, or however often states should be kept
+void rewind_capture();
+
+// Loads the capture before the last one loaded or taken. Returns
+// false if the history is empty.
+bool rewind_step();
+
+// Captures that can be stepped back to, and their packed size
+int rewind_count();
+size_t rewind_bytes();
+
+#endif
@@ -0,0 +1,123 @@
+#include "runahead.h"
+#include "gb.h"
+#include "pacing.h"
+#include "trace.h"
+
+#include <inttypes.h>
+
+// ------------------
+// Internal variables
+// ------------------
+
+_Thread_local int ahead_count;
+_Thread_local gb_state* ahead_state; // Where to go back to
+_Thread_local uint32_t ahead_gen;
+
+// Host time spent, and how much of it went on saving and going back
+_Thread_local int64_t ahead_calls;
+_Thread_local int64_t ahead_ns;
+_Thread_local int64_t ahead_state_ns;
+_Thread_local int64_t ahead_max_ns;
+
+// ------------------
+// Internal functions
+// ------------------
+
+void run_ahead_frame();
+
+// --------------------
+// Function definitions
+// --------------------
+
+bool runahead_init(int count) {
+   runahead_free();
+   if (count < 1) {
+      return true;
+   }
+   ahead_state = malloc(sizeof(gb_state));
+   if (ahead_state == NULL) {
+      return false;
+   }
+   ahead_count = count;
+   return true;
+}
+
+void runahead_free() {
+   free(ahead_state);
+   ahead_state    = NULL;
+   ahead_count    = 0;
+   ahead_gen      = 0;
+   ahead_calls    = 0;
+   ahead_ns       = 0;
+   ahead_state_ns = 0;
+   ahead_max_ns   = 0;
+}
+
+int runahead_frames() {
+   return ahead_count;
+}
+
+// Like gb_run_frame, but host timing doesn't count it as a frame
+void run_ahead_frame() {
+   cycle end = cpu_ticks + CYCLES_PER_FRAME / 4;
+   while (!lcd_ready() && (!lcd_disabled() || cpu_ticks < end)) {
+      gb_step();
+   }
+}
+
+void runahead_run() {
+   if (ahead_state == NULL) {
+      return;
+   }
+   int64_t start = pacing_now();
+   ahead_gen     = gb_update_state(ahead_state, ahead_gen, NULL);
+   int64_t saved = pacing_now();
+
+   // Queued input waits for the real frames, rather than being used
+   // up by these. Emulated events would run backwards, so the trace
+   // only shows the time this took.
+   bool tracing = trace_on;
+   trace_on     = false;
+   input_due    = INT64_MAX;
+   for (int i = 0; i < ahead_count; ++i) {
+      if (i == ahead_count - 1) {
+         lcd_request_frame();
+      }
+      run_ahead_frame();
+   }
+   trace_on = tracing;
+
+   int64_t ran = pacing_now();
+   gb_restore_state(ahead_state, ahead_gen);
+   int64_t end = pacing_now();
+   if (trace_on) {
+      trace_host("Run ahead", start, end);
+   }
+
+   ahead_calls++;
+   ahead_ns += end - start;
+   ahead_state_ns += (saved - start) + (end - ran);
+   if (end - start > ahead_max_ns) {
+      ahead_max_ns = end - start;
+   }
+}
+
+runahead_cost runahead_get_cost() {
+   runahead_cost c = {ahead_calls, ahead_ns, ahead_state_ns, ahead_max_ns};
+   return c;
+}
+
+void runahead_report(FILE* out) {
+   if (ahead_calls == 0) {
+      return;
+   }
+   fprintf(out,
+         "Running %d frames ahead, over %" PRId64 " frames:\n",
+         ahead_count,
+         ahead_calls);
+   fprintf(out, "  mean  %8.3f ms\n", ahead_ns / 1e6 / ahead_calls);
+   fprintf(out, "  max   %8.3f ms\n", ahead_max_ns / 1e6);
+   fprintf(out,
+         "  of which saving and going back %.3f ms\n",
+         ahead_state_ns / 1e6 / ahead_calls);
+}
@@ -0,0 +1,40 @@
+#ifndef __RUNAHEAD_H__
+#define __RUNAHEAD_H__
+
+#include "defines.h"
+
+// Hides the frame or two most games take to react to a button.
+// Whenever a frame is done, the machine is saved, run a few frames
+// further with the buttons held as they are, and put back, and the
+// frame shown is the last one it ran ahead to. Going back only
+// copies what running ahead wrote, so the cost is close to that of
+// emulating the extra frames without drawing them.
+//
+// Like rewind, it is per Game Boy.
+
+// Runs count frames ahead, or none to turn it off. Returns false if
+// the memory couldn't be allocated, which also turns it off.
+bool runahead_init(int count);
+void runahead_free();
+int runahead_frames();
+
+// Call when a frame is done, before showing it. The framebuffer is
+// left holding the frame count frames later. Only that frame is
+// drawn when the LCD is in LCD_RENDER_ON_DEMAND mode, which the
+// caller's own frames should use too, as they aren't shown.
+void runahead_run();
+
+// Host time spent running ahead since runahead_init
+typedef struct runahead_cost_ {
+   int64_t frames;   // Times it ran
+   int64_t total_ns;
+   int64_t state_ns; // Saving and going back
+   int64_t max_ns;   // Longest single run
+} runahead_cost;
+
+runahead_cost runahead_get_cost();
+
+// The cost per frame
+void runahead_report(FILE* out);
+
+#endif
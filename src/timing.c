@@ -0,0 +1,168 @@
+#include "timing.h"
+#include "pacing.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define USE_TSC
+#endif
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define MAX_ZONE_DEPTH 32
+
+// ------------------
+// Internal variables
+// ------------------
+
+const char* zone_names[ZONE_COUNT] = {
+   "other", "cpu", "memory", "lcd", "render", "timer", "dma", "present", "idle"};
+
+timing_zone zone_stack[MAX_ZONE_DEPTH];
+int zone_depth;
+uint64_t zone_mark;                // When the top zone last resumed
+uint64_t zone_ticks[ZONE_COUNT];   // This frame so far
+uint64_t (*frame_log)[ZONE_COUNT]; // Every finished frame
+int frame_log_count;
+int frame_log_size;
+uint64_t ticks_start;
+int64_t ns_start;
+
+// ------------------
+// Internal functions
+// ------------------
+
+uint64_t timing_ticks();
+double ns_per_tick();
+int compare_ticks(const void* a, const void* b);
+
+// --------------------
+// Function definitions
+// --------------------
+
+// The TSC is much cheaper to read than the monotonic clock, and
+// is converted to nanoseconds when reporting
+uint64_t timing_ticks() {
+#ifdef USE_TSC
+   return __rdtsc();
+#else
+   return pacing_now();
+#endif
+}
+
+double ns_per_tick() {
+   uint64_t ticks = timing_ticks() - ticks_start;
+   int64_t ns     = pacing_now() - ns_start;
+   return ticks > 0 ? (double)ns / ticks : 1;
+}
+
+void timing_reset() {
+   timing_free();
+   memset(zone_ticks, 0, sizeof(zone_ticks));
+   zone_depth    = 0;
+   zone_stack[0] = ZONE_OTHER;
+   ns_start      = pacing_now();
+   ticks_start   = timing_ticks();
+   zone_mark     = ticks_start;
+}
+
+void timing_free() {
+   free(frame_log);
+   frame_log       = NULL;
+   frame_log_count = 0;
+   frame_log_size  = 0;
+}
+
+// Charges the time since the last push or pop to the zone that was
+// running, then starts the new one
+void timing_push(timing_zone zone) {
+   uint64_t now = timing_ticks();
+   zone_ticks[zone_stack[zone_depth]] += now - zone_mark;
+   zone_mark = now;
+   if (zone_depth + 1 < MAX_ZONE_DEPTH) {
+      zone_stack[++zone_depth] = zone;
+   }
+}
+
+void timing_pop() {
+   uint64_t now = timing_ticks();
+   zone_ticks[zone_stack[zone_depth]] += now - zone_mark;
+   zone_mark = now;
+   if (zone_depth > 0) {
+      zone_depth--;
+   }
+}
+
+// Ends the current frame's totals and starts the next
+void timing_frame() {
+   uint64_t now = timing_ticks();
+   zone_ticks[zone_stack[zone_depth]] += now - zone_mark;
+   zone_mark = now;
+
+   if (frame_log_count == frame_log_size) {
+      frame_log_size = frame_log_size ? frame_log_size * 2 : 1024;
+      frame_log      = realloc(frame_log, frame_log_size * sizeof(*frame_log));
+   }
+   memcpy(frame_log[frame_log_count++], zone_ticks, sizeof(zone_ticks));
+   memset(zone_ticks, 0, sizeof(zone_ticks));
+}
+
+int compare_ticks(const void* a, const void* b) {
+   uint64_t x = *(const uint64_t*)a;
+   uint64_t y = *(const uint64_t*)b;
+   return (x > y) - (x < y);
+}
+
+void timing_report(FILE* out) {
+   if (frame_log_count == 0) {
+      return;
+   }
+   double scale = ns_per_tick();
+   uint64_t totals[ZONE_COUNT] = {0};
+   uint64_t all                = 0;
+   for (int f = 0; f < frame_log_count; ++f) {
+      for (int z = 0; z < ZONE_COUNT; ++z) {
+         totals[z] += frame_log[f][z];
+         all += frame_log[f][z];
+      }
+   }
+
+   uint64_t* sorted = malloc(frame_log_count * sizeof(uint64_t));
+   fprintf(out, "Host time over %d frames:\n", frame_log_count);
+   fprintf(out, "Zone          total ms      %%   us/frame   p99 us\n");
+   for (int z = 0; z < ZONE_COUNT; ++z) {
+      for (int f = 0; f < frame_log_count; ++f) {
+         sorted[f] = frame_log[f][z];
+      }
+      qsort(sorted, frame_log_count, sizeof(uint64_t), compare_ticks);
+      fprintf(out,
+            "%-10s %11.2f %6.2f %10.2f %8.2f\n",
+            zone_names[z],
+            totals[z] * scale / 1e6,
+            all ? 100.0 * totals[z] / all : 0,
+            totals[z] * scale / frame_log_count / 1e3,
+            sorted[(frame_log_count - 1) * 99 / 100] * scale / 1e3);
+   }
+   fprintf(out, "%-10s %11.2f\n", "total", all * scale / 1e6);
+   free(sorted);
+}
+
+// One row per frame, in nanoseconds
+void timing_write_csv(FILE* out) {
+   double scale = ns_per_tick();
+   fprintf(out, "frame");
+   for (int z = 0; z < ZONE_COUNT; ++z) {
+      fprintf(out, ",%s_ns", zone_names[z]);
+   }
+   fprintf(out, "\n");
+   for (int f = 0; f < frame_log_count; ++f) {
+      fprintf(out, "%d", f);
+      for (int z = 0; z < ZONE_COUNT; ++z) {
+         fprintf(out, ",%.0f", frame_log[f][z] * scale);
+      }
+      fprintf(out, "\n");
+   }
+}
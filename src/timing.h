@@ -0,0 +1,41 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include "defines.h"
+
+// Measures host time spent in each part of the emulator. Zones nest,
+// and each one only counts time not spent in the zones inside it.
+// Compiled out entirely unless built with HOST_TIMING.
+
+typedef enum timing_zone_ {
+   ZONE_OTHER,   // Anything outside another zone
+   ZONE_CPU,     // Instruction dispatch and execution
+   ZONE_MEMORY,  // rbyte / wbyte
+   ZONE_LCD,     // lcd_advance_time
+   ZONE_RENDER,  // Drawing scanlines
+   ZONE_TIMER,   // The DIV / TIMA loop in cpu_advance_time
+   ZONE_DMA,     // mem_advance_time while OAM DMA runs
+   ZONE_PRESENT, // Scaling and blitting in the frontend
+   ZONE_IDLE,    // Waiting on the pacing clock
+   ZONE_COUNT
+} timing_zone;
+
+#ifdef HOST_TIMING
+#define TIMING_BEGIN(zone) timing_push(zone)
+#define TIMING_END() timing_pop()
+#define TIMING_FRAME() timing_frame()
+#else
+#define TIMING_BEGIN(zone)
+#define TIMING_END()
+#define TIMING_FRAME()
+#endif
+
+void timing_reset();
+void timing_free();
+void timing_push(timing_zone zone);
+void timing_pop();
+void timing_frame();
+void timing_report(FILE* out);
+void timing_write_csv(FILE* out);
+
+#endif
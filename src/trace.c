@@ -0,0 +1,270 @@
+// nanosleep needs POSIX, which -std=c11 hides
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "cpu.h"
+#include "pacing.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+// ----------------
+// Internal defines
+// ----------------
+
+#define RING_SIZE 0x20000      // Must be a power of two
+#define FLUSH_INTERVAL 5000000 // ns the writer sleeps when caught up
+
+// One machine cycle is 1e9 / 2^20 ns
+#define NS_PER_TICK_NUM 1953125
+#define NS_PER_TICK_DEN 2048
+
+// Chrome trace process ids
+#define PID_EMULATED 1
+#define PID_HOST 2
+
+typedef struct trace_event_ {
+   int64_t ts;  // Machine cycles, or ns for TRACK_HOST
+   int64_t dur; // ns, complete events only
+   const char* name;
+   int arg;
+   char phase; // 'B'egin, 'E'nd, 'i'nstant or 'X' complete
+   byte track;
+} trace_event;
+
+// ------------------
+// Internal variables
+// ------------------
+
+bool trace_on;
+
+const char* track_names[TRACK_COUNT] = {
+   "LCD mode", "CPU", "Interrupts", "OAM DMA", "Banks", "Frontend"};
+
+// Single producer, single consumer ring, like the input queue.
+// The emulation thread only writes ring_head, the writer ring_tail.
+trace_event trace_ring[RING_SIZE];
+atomic_uint ring_head;
+atomic_uint ring_tail;
+atomic_bool writer_quit;
+pthread_t writer_thread;
+
+FILE* trace_out;
+int64_t trace_dropped;
+int64_t host_start; // pacing_now when the trace started
+
+// Whether each track has a begin with no end yet. A span that began
+// before the trace started has no begin in it, so its end is dropped.
+bool span_open[TRACK_COUNT];
+
+// ------------------
+// Internal functions
+// ------------------
+
+bool record(trace_event* e);
+char* put_str(char* p, const char* s);
+char* put_int(char* p, int64_t v);
+char* put_us(char* p, int64_t ns);
+void write_event(trace_event* e);
+unsigned drain();
+void* writer_main(void* unused);
+
+// --------------------
+// Function definitions
+// --------------------
+
+bool trace_start(const char* path) {
+   if (trace_on) {
+      trace_stop();
+   }
+   trace_out = fopen(path, "w");
+   if (trace_out == NULL) {
+      fprintf(stderr, "Couldn't open trace file %s\n", path);
+      return false;
+   }
+   fprintf(trace_out, "[\n");
+   fprintf(trace_out,
+         "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+         "\"args\":{\"name\":\"Emulated\"}},\n",
+         PID_EMULATED);
+   fprintf(trace_out,
+         "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+         "\"args\":{\"name\":\"Host\"}}",
+         PID_HOST);
+   for (int t = 0; t < TRACK_COUNT; ++t) {
+      fprintf(trace_out,
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            t == TRACK_HOST ? PID_HOST : PID_EMULATED,
+            t,
+            track_names[t]);
+   }
+   trace_dropped = 0;
+   host_start    = pacing_now();
+   memset(span_open, 0, sizeof(span_open));
+   atomic_store(&ring_head, 0);
+   atomic_store(&ring_tail, 0);
+   atomic_store(&writer_quit, false);
+   pthread_create(&writer_thread, NULL, writer_main, NULL);
+   trace_on = true;
+   return true;
+}
+
+// Writes out everything still in the ring and closes the file
+void trace_stop() {
+   if (!trace_on) {
+      return;
+   }
+   trace_on = false;
+   atomic_store(&writer_quit, true);
+   pthread_join(writer_thread, NULL);
+   fprintf(trace_out, "\n]\n");
+   fclose(trace_out);
+   trace_out = NULL;
+   if (trace_dropped > 0) {
+      fprintf(stderr,
+            "Trace dropped %" PRId64 " events, the writer fell behind\n",
+            trace_dropped);
+   }
+}
+
+// Returns false if the event was dropped
+bool record(trace_event* e) {
+   unsigned head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+   unsigned tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+   if (head - tail >= RING_SIZE) {
+      trace_dropped++;
+      return false;
+   }
+   trace_ring[head % RING_SIZE] = *e;
+   atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+   return true;
+}
+
+void trace_begin(trace_track track, const char* name, int arg) {
+   trace_event e    = {cpu_ticks, 0, name, arg, 'B', track};
+   span_open[track] = record(&e);
+}
+
+void trace_end(trace_track track) {
+   if (!span_open[track]) {
+      return;
+   }
+   trace_event e    = {cpu_ticks, 0, NULL, -1, 'E', track};
+   span_open[track] = false;
+   record(&e);
+}
+
+void trace_instant(trace_track track, const char* name, int arg) {
+   trace_event e = {cpu_ticks, 0, name, arg, 'i', track};
+   record(&e);
+}
+
+void trace_host(const char* name, int64_t start, int64_t end) {
+   trace_event e = {start, end - start, name, -1, 'X', TRACK_HOST};
+   record(&e);
+}
+
+char* put_str(char* p, const char* s) {
+   while (*s != '\0') {
+      *p++ = *s++;
+   }
+   return p;
+}
+
+char* put_int(char* p, int64_t v) {
+   char digits[20];
+   int n = 0;
+   if (v < 0) {
+      *p++ = '-';
+      v    = -v;
+   }
+   do {
+      digits[n++] = '0' + v % 10;
+      v /= 10;
+   } while (v > 0);
+   while (n > 0) {
+      *p++ = digits[--n];
+   }
+   return p;
+}
+
+// Microseconds with three decimals, as the viewers expect.
+// Every time written is positive.
+char* put_us(char* p, int64_t ns) {
+   p    = put_int(p, ns / 1000);
+   *p++ = '.';
+   *p++ = '0' + ns / 100 % 10;
+   *p++ = '0' + ns / 10 % 10;
+   *p++ = '0' + ns % 10;
+   return p;
+}
+
+// Formats by hand, since printf can't keep up with the emulator
+void write_event(trace_event* e) {
+   char line[256];
+   char* p    = line;
+   int64_t ns = e->ts * NS_PER_TICK_NUM / NS_PER_TICK_DEN;
+   int pid    = PID_EMULATED;
+   if (e->track == TRACK_HOST) {
+      ns  = e->ts - host_start;
+      pid = PID_HOST;
+   }
+   p    = put_str(p, ",\n{\"ph\":\"");
+   *p++ = e->phase;
+   p    = put_str(p, "\",\"pid\":");
+   p    = put_int(p, pid);
+   p    = put_str(p, ",\"tid\":");
+   p    = put_int(p, e->track);
+   p    = put_str(p, ",\"ts\":");
+   p    = put_us(p, ns);
+   if (e->name != NULL) {
+      p = put_str(p, ",\"name\":\"");
+      p = put_str(p, e->name);
+      p = put_str(p, "\"");
+   }
+   if (e->phase == 'X') {
+      p = put_str(p, ",\"dur\":");
+      p = put_us(p, e->dur);
+   } else if (e->phase == 'i') {
+      p = put_str(p, ",\"s\":\"t\"");
+   }
+   if (e->arg >= 0) {
+      p = put_str(p, ",\"args\":{\"value\":");
+      p = put_int(p, e->arg);
+      p = put_str(p, "}");
+   }
+   *p++ = '}';
+   fwrite(line, 1, p - line, trace_out);
+}
+
+// Writes every event in the ring, returning how many there were
+unsigned drain() {
+   unsigned tail  = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+   unsigned head  = atomic_load_explicit(&ring_head, memory_order_acquire);
+   unsigned count = head - tail;
+   while (tail != head) {
+      write_event(&trace_ring[tail % RING_SIZE]);
+      tail++;
+      // Hand space back as we go, so a full ring doesn't wait
+      // for the whole batch
+      if ((tail & 0xFF) == 0) {
+         atomic_store_explicit(&ring_tail, tail, memory_order_release);
+      }
+   }
+   atomic_store_explicit(&ring_tail, tail, memory_order_release);
+   return count;
+}
+
+void* writer_main(void* unused) {
+   struct timespec nap = {0, FLUSH_INTERVAL};
+   while (!atomic_load(&writer_quit)) {
+      if (drain() == 0) {
+         nanosleep(&nap, NULL);
+      }
+   }
+   drain();
+   return unused;
+}
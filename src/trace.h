@@ -0,0 +1,42 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "defines.h"
+
+// Records a timeline of what the emulated hardware and the frontend
+// did, as Chrome trace event JSON. The file opens in chrome://tracing
+// or ui.perfetto.dev. Emulated events are stamped with the cycle
+// count, so one microsecond in the viewer is one emulated microsecond.
+// Host events go in a separate process stamped with host time.
+//
+// Events go into a fixed size ring and a background thread writes
+// them out. If the writer falls behind, new events are dropped and
+// counted rather than stalling emulation. Only the emulation thread
+// may record events.
+
+typedef enum trace_track_ {
+   TRACK_LCD,       // STAT mode
+   TRACK_CPU,       // HALT
+   TRACK_INTERRUPT, // Interrupts dispatched
+   TRACK_DMA,       // OAM DMA
+   TRACK_BANK,      // ROM bank switches
+   TRACK_HOST,      // Frontend work, in host time
+   TRACK_COUNT
+} trace_track;
+
+// Check this before recording, so nothing is spent when not tracing
+extern bool trace_on;
+
+bool trace_start(const char* path);
+void trace_stop();
+
+// Names must be string literals or otherwise outlive the trace.
+// Pass a negative arg for events without one.
+void trace_begin(trace_track track, const char* name, int arg);
+void trace_end(trace_track track);
+void trace_instant(trace_track track, const char* name, int arg);
+
+// Something the frontend spent from start to end, in pacing_now time
+void trace_host(const char* name, int64_t start, int64_t end);
+
+#endif